@@ -3844,6 +3844,12 @@ void GlobalParams::setScreenWhiteThreshold(double thresh) {
   unlockGlobalParams;
 }
 
+void GlobalParams::setDrawAnnotations(GBool draw) {
+  lockGlobalParams;
+  drawAnnotations = draw;
+  unlockGlobalParams;
+}
+
 void GlobalParams::setDrawFormFields(GBool draw) {
   lockGlobalParams;
   drawFormFields = draw;
@@ -418,6 +418,7 @@ public:
   void setScreenGamma(double gamma);
   void setScreenBlackThreshold(double thresh);
   void setScreenWhiteThreshold(double thresh);
+  void setDrawAnnotations(GBool draw);
   void setDrawFormFields(GBool draw);
   void setOverprintPreview(GBool preview);
   void setMapNumericCharNames(GBool map);
@@ -59,6 +59,7 @@
 #    include <unixlib.h>
 #  endif
 #endif // _WIN32
+#include <string.h>
 #include "gmem.h"
 #include "gmempp.h"
 #include "GString.h"
@@ -754,6 +755,25 @@ GFileOffset gftell(FILE *f) {
 #endif
 }
 
+void gfprefetch(FILE *f, GFileOffset offset, GFileOffset len) {
+#if defined(POSIX_FADV_WILLNEED)
+  posix_fadvise(fileno(f), offset, len, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+  struct radvisory ra;
+
+  // ra_count is an int, so hint huge ranges in pieces
+  while (len > 0) {
+    ra.ra_offset = offset;
+    ra.ra_count = len > 0x40000000 ? 0x40000000 : (int)len;
+    if (fcntl(fileno(f), F_RDADVISE, &ra) < 0) {
+      break;
+    }
+    offset += ra.ra_count;
+    len -= ra.ra_count;
+  }
+#endif
+}
+
 void fixCommandLine(int *argc, char **argv[]) {
 #ifdef _WIN32
   int argcw;
@@ -822,6 +842,316 @@ GooFile* GooFile::open(GString *fileName) {
 
 #endif // _WIN32
 
+//------------------------------------------------------------------------
+// GRangeFile
+//------------------------------------------------------------------------
+
+// How often (in ms) a reader waiting for missing data checks again.
+#define rangePollInterval 10
+
+// The stand-in fetcher delivers data in blocks of this size.
+#define rangeBlockSize 65536
+
+#if MULTITHREADED
+#  define lockRangeFile   gLockMutex(&mutex)
+#  define unlockRangeFile gUnlockMutex(&mutex)
+#else
+#  define lockRangeFile
+#  define unlockRangeFile
+#endif
+
+struct GFileRange {
+  GFileOffset start, end;
+};
+
+// Sorted, non-overlapping, non-adjacent set of byte ranges.
+class GRangeSet {
+public:
+
+  GRangeSet(): ranges(NULL), n(0), size(0) {}
+  ~GRangeSet() { gfree(ranges); }
+
+  // Add [<start>, <end>), merging it with any ranges it overlaps or
+  // touches.
+  void add(GFileOffset start, GFileOffset end);
+
+  // Is all of [<start>, <end>) in the set?
+  GBool contains(GFileOffset start, GFileOffset end);
+
+  int getLength() { return n; }
+  GFileRange *get(int i) { return &ranges[i]; }
+
+private:
+
+  // Index of the first range ending at or after <pos>.
+  int find(GFileOffset pos);
+
+  GFileRange *ranges;
+  int n, size;
+};
+
+int GRangeSet::find(GFileOffset pos) {
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = n;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (ranges[mid].end < pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+void GRangeSet::add(GFileOffset start, GFileOffset end) {
+  int i, j;
+
+  if (start >= end) {
+    return;
+  }
+  i = find(start);
+  for (j = i; j < n && ranges[j].start <= end; ++j) {
+    if (ranges[j].start < start) {
+      start = ranges[j].start;
+    }
+    if (ranges[j].end > end) {
+      end = ranges[j].end;
+    }
+  }
+  if (j == i) {
+    if (n == size) {
+      size = size ? 2 * size : 16;
+      ranges = (GFileRange *)greallocn(ranges, size, sizeof(GFileRange));
+    }
+    memmove(&ranges[i + 1], &ranges[i], (n - i) * sizeof(GFileRange));
+    ++n;
+  } else if (j > i + 1) {
+    memmove(&ranges[i + 1], &ranges[j], (n - j) * sizeof(GFileRange));
+    n -= j - i - 1;
+  }
+  ranges[i].start = start;
+  ranges[i].end = end;
+}
+
+GBool GRangeSet::contains(GFileOffset start, GFileOffset end) {
+  int i;
+
+  if (start >= end) {
+    return gTrue;
+  }
+  i = find(start + 1);
+  return i < n && ranges[i].start <= start && ranges[i].end >= end;
+}
+
+static void sleepMS(int ms) {
+#ifdef _WIN32
+  Sleep(ms);
+#else
+  usleep(ms * 1000);
+#endif
+}
+
+// Parse a "<start> <length>" line.
+static GBool parseRangeLine(char *line, GFileOffset *start,
+			    GFileOffset *len) {
+  GFileOffset x[2];
+  char *p;
+  int i;
+
+  p = line;
+  for (i = 0; i < 2; ++i) {
+    while (*p == ' ' || *p == '\t') {
+      ++p;
+    }
+    if (*p < '0' || *p > '9') {
+      return gFalse;
+    }
+    x[i] = 0;
+    while (*p >= '0' && *p <= '9') {
+      x[i] = 10 * x[i] + (*p - '0');
+      ++p;
+    }
+  }
+  *start = x[0];
+  *len = x[1];
+  return gTrue;
+}
+
+GRangeFile *GRangeFile::open(GString *fileName, GString *rangesFileName) {
+  GRangeFile *rangeFile;
+  FILE *fA;
+  GFileOffset sizeA;
+
+  if (!(fA = openFile(fileName->getCString(), "rb"))) {
+    return NULL;
+  }
+  if (gfseek(fA, 0, SEEK_END) != 0 || (sizeA = gftell(fA)) < 0) {
+    fclose(fA);
+    return NULL;
+  }
+  rangeFile = new GRangeFile(fA, sizeA);
+  if (rangesFileName) {
+    rangeFile->rangesFileName = rangesFileName->copy();
+  }
+  return rangeFile;
+}
+
+GRangeFile *GRangeFile::openWithDelay(GString *fileName, int delay) {
+  GRangeFile *rangeFile;
+
+  if ((rangeFile = open(fileName, NULL))) {
+    rangeFile->delay = delay < 0 ? 0 : delay;
+    rangeFile->setWaitTime(rangeFile->waitTime);
+  }
+  return rangeFile;
+}
+
+GRangeFile::GRangeFile(FILE *fA, GFileOffset sizeA) {
+  f = fA;
+  size = sizeA;
+  rangesFileName = NULL;
+  rangesFilePos = 0;
+  delay = -1;
+  waitTime = 0;
+  available = new GRangeSet();
+  needed = new GRangeSet();
+  nMissing = 0;
+#if MULTITHREADED
+  gInitMutex(&mutex);
+#endif
+}
+
+GRangeFile::~GRangeFile() {
+  fclose(f);
+  if (rangesFileName) {
+    delete rangesFileName;
+  }
+  delete available;
+  delete needed;
+#if MULTITHREADED
+  gDestroyMutex(&mutex);
+#endif
+}
+
+void GRangeFile::setWaitTime(int waitTimeA) {
+  waitTime = waitTimeA;
+  if (delay >= 0 && waitTime >= 0 && waitTime < delay) {
+    waitTime = delay;
+  }
+}
+
+void GRangeFile::addRange(GFileOffset start, GFileOffset len) {
+  lockRangeFile;
+  available->add(start, start + len);
+  unlockRangeFile;
+}
+
+GBool GRangeFile::isAvailable(GFileOffset start, GFileOffset len) {
+  GBool avail;
+
+  lockRangeFile;
+  avail = available->contains(start, start + len);
+  unlockRangeFile;
+  return avail;
+}
+
+int GRangeFile::read(char *buf, int len, GFileOffset offset) {
+  int n;
+
+  if (offset < 0 || offset >= size || len <= 0) {
+    return 0;
+  }
+  if (len > size - offset) {
+    len = (int)(size - offset);
+  }
+  lockRangeFile;
+  needed->add(offset, offset + len);
+  unlockRangeFile;
+  if (!waitFor(offset, len)) {
+    ++nMissing;
+    return -1;
+  }
+  if (gfseek(f, offset, SEEK_SET) != 0) {
+    return -1;
+  }
+  n = (int)fread(buf, 1, len, f);
+  return n;
+}
+
+GBool GRangeFile::waitFor(GFileOffset start, GFileOffset len) {
+  GFileOffset blockStart, blockEnd;
+  int waited;
+
+  waited = 0;
+  while (!isAvailable(start, len)) {
+    if (rangesFileName) {
+      readRangesFile();
+      if (isAvailable(start, len)) {
+        break;
+      }
+    }
+    if (delay >= 0 && waited >= delay) {
+      blockStart = start - start % rangeBlockSize;
+      blockEnd = start + len + rangeBlockSize - 1;
+      blockEnd -= blockEnd % rangeBlockSize;
+      if (blockEnd > size) {
+        blockEnd = size;
+      }
+      addRange(blockStart, blockEnd - blockStart);
+      break;
+    }
+    if (waitTime >= 0 && waited >= waitTime) {
+      return gFalse;
+    }
+    sleepMS(rangePollInterval);
+    waited += rangePollInterval;
+  }
+  return gTrue;
+}
+
+// Parse any complete lines the fetcher has added to the ranges file
+// since the last call.
+void GRangeFile::readRangesFile() {
+  FILE *rf;
+  char line[256];
+  GFileOffset start, len;
+  size_t n;
+
+  if (!(rf = openFile(rangesFileName->getCString(), "rb"))) {
+    return;
+  }
+  if (gfseek(rf, rangesFilePos, SEEK_SET) == 0) {
+    while (fgets(line, sizeof(line), rf)) {
+      n = strlen(line);
+      // stop at a line that is still being written
+      if (line[n - 1] != '\n' && n < sizeof(line) - 1) {
+        break;
+      }
+      rangesFilePos += n;
+      if (parseRangeLine(line, &start, &len)) {
+        addRange(start, len);
+      }
+    }
+  }
+  fclose(rf);
+}
+
+void GRangeFile::writeNeededRanges(FILE *out) {
+  GFileRange *range;
+  int i;
+
+  lockRangeFile;
+  for (i = 0; i < needed->getLength(); ++i) {
+    range = needed->get(i);
+    fprintf(out, "%lld %lld\n",
+	    (long long)range->start, (long long)(range->end - range->start));
+  }
+  unlockRangeFile;
+}
+
 //------------------------------------------------------------------------
 // GDir and GDirEntry
 //------------------------------------------------------------------------
@@ -52,6 +52,9 @@
 
 #endif
 #include "gtypes.h"
+#if MULTITHREADED
+#include "GMutex.h"
+#endif
 
 class GString;
 
@@ -151,6 +154,11 @@ extern int gfseek(FILE *f, GFileOffset offset, int whence);
 // Like ftell, but returns a 64-bit file offset if available.
 extern GFileOffset gftell(FILE *f);
 
+// Ask the OS to start reading [<offset>, <offset> + <len>) of <f> into
+// its cache without waiting for it (posix_fadvise WILLNEED on Linux,
+// F_RDADVISE on macOS).  This is a nop on other systems.
+extern void gfprefetch(FILE *f, GFileOffset offset, GFileOffset len);
+
 // On Windows, this gets the Unicode command line and converts it to
 // UTF-8.  On other systems, this is a nop.
 extern void fixCommandLine(int *argc, char **argv[]);
@@ -182,6 +190,83 @@ private:
 #endif // _WIN32
 };
 
+//------------------------------------------------------------------------
+// GRangeFile
+//------------------------------------------------------------------------
+
+class GRangeSet;
+
+// A file that is only partly present, e.g. while it is still being
+// downloaded into place at its full size.  Byte ranges become readable
+// once they are marked available, either with addRange() or by
+// "<start> <length>" lines that the fetcher appends to a ranges file.
+// Every range a reader asks for is recorded, so the fetcher can be
+// told exactly which parts of the file were needed.
+class GRangeFile {
+public:
+
+	// Open <fileName>, reading availability from <rangesFileName>.  If
+	// <rangesFileName> is NULL, nothing is available until addRange()
+	// is called.  Returns NULL on error.
+	static GRangeFile *open(GString *fileName, GString *rangesFileName);
+
+	// Local stand-in for a fetcher: all of <fileName> is present, but
+	// each missing block only arrives <delay> ms after a reader starts
+	// waiting for it.  With a delay of 0 this just records the ranges
+	// that are read.
+	static GRangeFile *openWithDelay(GString *fileName, int delay);
+
+	~GRangeFile();
+
+	GFileOffset getSize() { return size; }
+
+	// Set how long (in ms) read() waits for missing data: 0 (the
+	// default) fails at once, a negative value waits forever.  For the
+	// local stand-in, waits shorter than its delay are raised to the
+	// delay, so its blocks can arrive.
+	void setWaitTime(int waitTimeA);
+
+	// Mark [<start>, <start> + <len>) as available.  This may be called
+	// from another thread.
+	void addRange(GFileOffset start, GFileOffset len);
+
+	// Is all of [<start>, <start> + <len>) available?
+	GBool isAvailable(GFileOffset start, GFileOffset len);
+
+	// Read up to <len> bytes at <offset>, stopping at the end of the
+	// file.  Returns the number of bytes read, or -1 if the data did
+	// not become available within the wait time.
+	int read(char *buf, int len, GFileOffset offset);
+
+	// Number of reads that failed because data was missing.
+	int getNumMissing() { return nMissing; }
+
+	// Write the ranges read so far, merged, as "<start> <length>"
+	// lines.
+	void writeNeededRanges(FILE *out);
+
+private:
+	GRangeFile(FILE *fA, GFileOffset sizeA);
+	GRangeFile(const GRangeFile &other);
+	GRangeFile& operator=(const GRangeFile &other);
+
+	GBool waitFor(GFileOffset start, GFileOffset len);
+	void readRangesFile();
+
+	FILE *f;
+	GFileOffset size;
+	GString *rangesFileName;	// NULL if ranges come from addRange()
+	GFileOffset rangesFilePos;	// bytes of the ranges file parsed so far
+	int delay;			// stand-in fetch delay (ms), or -1
+	int waitTime;			// ms to wait for missing data, <0 = forever
+	GRangeSet *available;
+	GRangeSet *needed;
+	int nMissing;
+#if MULTITHREADED
+	GMutex mutex;
+#endif
+};
+
 //------------------------------------------------------------------------
 // GDir and GDirEntry
 //------------------------------------------------------------------------
@@ -8,26 +8,37 @@
 #include "GList.h"
 #include <aconf.h>
 #include <stdio.h>
+#include <math.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
 #include <string>
 #include <sstream>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <set>
+#include <vector>
 #include "gmem.h"
 #include "gmempp.h"
+#include "gfile.h"
 #include "parseargs.h"
 #include "GString.h"
+#include "GHash.h"
 #include "GlobalParams.h"
 #include "Object.h"
 #include "Stream.h"
 #include "Array.h"
 #include "Dict.h"
+#include "Lexer.h"
+#include "Parser.h"
 #include "XRef.h"
 #include "Catalog.h"
 #include "Page.h"
+#include "GfxState.h"
 #include "PDFDoc.h"
 #include "TextOutputDev.h"
 #include "CharTypes.h"
@@ -39,6 +50,7 @@
 
 static int firstPage = 1;
 static int lastPage = 0;
+static char pagesStr[1024] = "";
 static GBool physLayout = gFalse;
 static GBool simpleLayout = gFalse;
 static GBool tableLayout = gFalse;
@@ -54,13 +66,33 @@ static GBool quiet = gFalse;
 static GBool printVersion = gFalse;
 static GBool printHelp = gFalse;
 static GBool json = gFalse;
+static GBool probe = gFalse;
+static GBool columnar = gFalse;
 static char datadir[8192] = "";
+static char pageIndexFileName[8192] = "";
+static char fieldsStr[1024] = "";
+static int quantizeGrid = 0;
+static GBool stringTable = gFalse;
+static int maxChars = 0;
+static double pageTimeout = 0;
+static double docTimeout = 0;
+static double maxOutput = 0;
+static GBool textOnly = gFalse;
+static GBool noAnnots = gFalse;
+static GBool annotsJSON = gFalse;
+static char rangesFileName[8192] = "";
+static double rangeWait = 0;
+static int rangeDelay = -1;
+static char neededRangesFileName[8192] = "";
+static GBool prefetch = gFalse;
 
 static ArgDesc argDesc[] = {
         {"-f",           argInt,    &firstPage,        0,
                 "first page to convert"},
         {"-l",           argInt,    &lastPage,         0,
                 "last page to convert"},
+        {"-pages",       argString, pagesStr,          sizeof(pagesStr),
+                "pages to convert, e.g. 1-3,-2--1 (negative counts from the end)"},
         {"-layout",      argFlag,   &physLayout,       0,
                 "maintain original physical layout"},
         {"-simple",      argFlag,   &simpleLayout,     0,
@@ -83,6 +115,42 @@ static ArgDesc argDesc[] = {
                 "data directory"},
         {"-json",        argFlag,   &json,             0,
                 "output JSON with metadata, layout and rich text"},
+        {"-pageindex",   argString, pageIndexFileName, sizeof(pageIndexFileName),
+                "JSON: write byte offset and length of each page to file"},
+        {"-fields",      argString, fieldsStr,         sizeof(fieldsStr),
+                "JSON: comma-separated word attributes to output"},
+        {"-quantize",    argInt,    &quantizeGrid,     0,
+                "JSON: emit integer coordinates in 1/N pt, delta-encoded per line"},
+        {"-strtable",    argFlag,   &stringTable,      0,
+                "JSON: write repeated word strings once and refer to them by index"},
+        {"-maxchars",    argInt,    &maxChars,         0,
+                "JSON: characters per page before falling back to raw order"},
+        {"-pagetimeout", argFP,     &pageTimeout,      0,
+                "JSON: seconds per page before falling back to raw order"},
+        {"-timeout",     argFP,     &docTimeout,       0,
+                "JSON: seconds for the whole document before stopping"},
+        {"-maxoutput",   argFP,     &maxOutput,        0,
+                "JSON: stop after writing this many megabytes"},
+        {"-textonly",    argFlag,   &textOnly,         0,
+                "JSON: don't process image data while extracting text"},
+        {"-noannots",    argFlag,   &noAnnots,         0,
+                "don't extract text from annotations and form fields"},
+        {"-annots",      argFlag,   &annotsJSON,       0,
+                "JSON: list annotation text separately for each page"},
+        {"-columnar",    argFlag,   &columnar,         0,
+                "JSON: emit each page as per-attribute word arrays"},
+        {"-probe",       argFlag,   &probe,            0,
+                "output JSON with per-page glyph and image counts only"},
+        {"-ranges",      argString, rangesFileName,    sizeof(rangesFileName),
+                "input is partial: read its available byte ranges from file"},
+        {"-rangewait",   argFP,     &rangeWait,        0,
+                "seconds to wait for missing input ranges (<0: forever)"},
+        {"-rangedelay",  argInt,    &rangeDelay,       0,
+                "serve input in blocks arriving after this many ms (testing)"},
+        {"-neededranges", argString, neededRangesFileName, sizeof(neededRangesFileName),
+                "write the input byte ranges that were read to file"},
+        {"-prefetch",    argFlag,   &prefetch,         0,
+                "read ahead the objects of the next page while converting"},
         {"-nopgbrk",     argFlag,   &noPageBreaks,     0,
                 "don't insert page breaks between pages"},
         {"-q",           argFlag,   &quiet,            0,
@@ -100,6 +168,136 @@ static ArgDesc argDesc[] = {
         {NULL}
 };
 
+//------------------------------------------------------------------------
+// word attributes that can be selected with -fields
+//------------------------------------------------------------------------
+
+#define wordFieldBBox       (1 << 0)
+#define wordFieldFontSize   (1 << 1)
+#define wordFieldSpaceAfter (1 << 2)
+#define wordFieldBaseline   (1 << 3)
+#define wordFieldRotation   (1 << 4)
+#define wordFieldUnderlined (1 << 5)
+#define wordFieldBold       (1 << 6)
+#define wordFieldItalic     (1 << 7)
+#define wordFieldColor      (1 << 8)
+#define wordFieldFont       (1 << 9)
+#define wordFieldText       (1 << 10)
+#define wordFieldAll        ((1 << 11) - 1)
+
+// in output order
+static const char *wordFieldNames[] = {
+  "bbox",
+  "fontsize",
+  "spaceafter",
+  "baseline",
+  "rotation",
+  "underlined",
+  "bold",
+  "italic",
+  "color",
+  "font",
+  "text",
+  NULL
+};
+
+static int wordFields = wordFieldAll;
+
+// Parse a comma-separated list of field names into a wordField*
+// mask.  Returns false on an unknown name.
+static GBool parseWordFields(const char *s, int *fields) {
+  const char *p, *q;
+  size_t n;
+  int i;
+
+  *fields = 0;
+  for (p = s; *p; p = *q ? q + 1 : q) {
+    for (q = p; *q && *q != ','; ++q) ;
+    n = (size_t)(q - p);
+    if (!n) {
+      continue;
+    }
+    for (i = 0; wordFieldNames[i]; ++i) {
+      if (strlen(wordFieldNames[i]) == n && !strncmp(p, wordFieldNames[i], n)) {
+        break;
+      }
+    }
+    if (!wordFieldNames[i]) {
+      return gFalse;
+    }
+    *fields |= 1 << i;
+  }
+  return *fields != 0;
+}
+
+//------------------------------------------------------------------------
+// page selection (-pages)
+//------------------------------------------------------------------------
+
+// Parse a page number at *<p>, advancing *<p>.  Negative numbers count
+// from the end (-1 is the last page).  Returns false if there is no
+// number.
+static GBool parsePageNum(const char **p, int nPages, int *page) {
+  char *end;
+  long n;
+
+  n = strtol(*p, &end, 10);
+  if (end == *p) {
+    return gFalse;
+  }
+  *p = end;
+  *page = n < 0 ? nPages + 1 + (int)n : (int)n;
+  return gTrue;
+}
+
+// Parse a comma-separated list of pages and ranges ("1-3,-2--1,10",
+// "5-" for 5 to the end) into a sorted list of distinct page numbers
+// in 1..<nPages>.  Returns false on a syntax error.
+static GBool parsePageList(const char *s, int nPages, std::vector<int> &pages) {
+  std::vector<char> selected(nPages + 1, 0);
+  const char *p;
+  int from, to, pg;
+
+  p = s;
+  while (*p) {
+    if (*p == ',') {
+      ++p;
+      continue;
+    }
+    if (!parsePageNum(&p, nPages, &from)) {
+      return gFalse;
+    }
+    to = from;
+    if (*p == '-') {
+      ++p;
+      if (!*p || *p == ',') {
+        to = nPages;
+      } else if (!parsePageNum(&p, nPages, &to)) {
+        return gFalse;
+      }
+    }
+    if (*p && *p != ',') {
+      return gFalse;
+    }
+    if (from < 1) {
+      from = 1;
+    }
+    if (to > nPages) {
+      to = nPages;
+    }
+    for (pg = from; pg <= to; ++pg) {
+      selected[pg] = 1;
+    }
+  }
+  pages.clear();
+  for (pg = 1; pg <= nPages; ++pg) {
+    if (selected[pg]) {
+      pages.push_back(pg);
+    }
+  }
+  return gTrue;
+}
+
 // From https://stackoverflow.com/a/33799784
 std::string escape_json(const std::string &s) {
     std::ostringstream o;
@@ -121,65 +319,1679 @@ std::string escape_json(const std::string &s) {
                 }
         }
     }
-    return o.str();
+    return o.str();
+}
+
+// Convert a PDF text string (PDFDocEncoding or UTF-16BE with BOM) to
+// escaped JSON string contents.
+static std::string textStringToJSON(GString *s1, UnicodeMap *uMap) {
+  GBool isUnicode;
+  Unicode u;
+  char buf[9];
+  int i, n;
+
+  if ((s1->getChar(0) & 0xff) == 0xfe &&
+      (s1->getChar(1) & 0xff) == 0xff) {
+    isUnicode = gTrue;
+    i = 2;
+  } else {
+    isUnicode = gFalse;
+    i = 0;
+  }
+  std::string valueStr = "";
+  while (i < s1->getLength()) {
+    if (isUnicode) {
+      u = ((s1->getChar(i) & 0xff) << 8) |
+          (s1->getChar(i + 1) & 0xff);
+      i += 2;
+    } else {
+      u = pdfDocEncoding[s1->getChar(i) & 0xff];
+      ++i;
+    }
+    n = uMap->mapUnicode(u, buf, sizeof(buf));
+    buf[n] = '\0';
+    valueStr += escape_json(buf);
+  }
+  return valueStr;
+}
+
+static void printInfoJSON(FILE *f, Dict *infoDict, UnicodeMap *uMap) {
+  bool firstE = true;
+  for (int k = 0; k < infoDict->getLength(); k++) {
+    const std::string keyStr = escape_json(infoDict->getKey(k));
+    if (!keyStr.length()) continue;
+    Object obj;
+    infoDict->getVal(k, &obj);
+    if (obj.isString()) {
+      if (firstE) firstE = false; else fprintf(f, ",");
+      const std::string valueStr = textStringToJSON(obj.getString(), uMap);
+      fprintf(f, "\"%s\":\"%s\"", keyStr.c_str(), valueStr.c_str());
+    }
+    obj.free();
+  }
+}
+
+// Map a point in default user space to the top-left based page
+// coordinates TextOutputDev uses (72 dpi, media box, page rotation).
+static void userToPageCoords(Page *page, double x, double y,
+                             double *px, double *py) {
+  PDFRectangle *box = page->getMediaBox();
+
+  switch (page->getRotate()) {
+  case 90:
+    *px = y - box->y1;
+    *py = x - box->x1;
+    break;
+  case 180:
+    *px = box->x2 - x;
+    *py = y - box->y1;
+    break;
+  case 270:
+    *px = box->y2 - y;
+    *py = box->x2 - x;
+    break;
+  default:
+    *px = x - box->x1;
+    *py = box->y2 - y;
+    break;
+  }
+}
+
+// Write a page's annotations as "annotations":[[subtype, xMin, yMin,
+// xMax, yMax, text], ...], read straight from the annotation
+// dictionaries: the text is /Contents, or the field value /V for
+// widgets without /Contents.  Popups only repeat their parent's text
+// and are left out.
+static void printAnnotsJSON(FILE *f, Page *page, UnicodeMap *uMap) {
+  Object annots, annot, subtype, rect, coord, text;
+  double r[4], x0, y0, x1, y1;
+  int i, j;
+
+  fprintf(f, "\"annotations\":[");
+  bool firstA = true;
+  if (page->getAnnots(&annots)->isArray()) {
+    for (i = 0; i < annots.arrayGetLength(); ++i) {
+      if (!annots.arrayGet(i, &annot)->isDict()) {
+        annot.free();
+        continue;
+      }
+      annot.dictLookup("Subtype", &subtype);
+      annot.dictLookup("Rect", &rect);
+      if (subtype.isName() && !subtype.isName("Popup") &&
+          rect.isArray() && rect.arrayGetLength() == 4) {
+        for (j = 0; j < 4; ++j) {
+          r[j] = rect.arrayGet(j, &coord)->isNum() ? coord.getNum() : 0;
+          coord.free();
+        }
+        userToPageCoords(page, r[0], r[1], &x0, &y0);
+        userToPageCoords(page, r[2], r[3], &x1, &y1);
+        if (!annot.dictLookup("Contents", &text)->isString() &&
+            subtype.isName("Widget")) {
+          text.free();
+          annot.dictLookup("V", &text);
+        }
+        if (firstA) firstA = false; else fprintf(f, ",");
+        fprintf(f, "[\"%s\",%g,%g,%g,%g,\"%s\"]",
+                escape_json(subtype.getName()).c_str(),
+                x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1,
+                x0 < x1 ? x1 : x0, y0 < y1 ? y1 : y0,
+                text.isString() ? textStringToJSON(text.getString(), uMap).c_str()
+                                : "");
+        text.free();
+      }
+      rect.free();
+      subtype.free();
+      annot.free();
+    }
+  }
+  annots.free();
+  fprintf(f, "]");
+}
+
+// Instead of the actual RGB offsets we only output a unique color number
+static int getColorNum(TextWord *word, std::map<std::string, int> &colors) {
+  double dr, dg, db;
+  int r, g, b;
+  char colorStr[256];
+  std::map<std::string, int>::iterator it;
+
+  word->getColor(&dr, &dg, &db);
+  r = 255.0 * dr;
+  g = 255.0 * dg;
+  b = 255.0 * db;
+
+  sprintf(colorStr, "%02x%02x%02x", r, g, b);
+
+  colors.insert(std::make_pair(colorStr, colors.size()));
+  it = colors.find(colorStr);
+  if (it != colors.end()) {
+    return it->second;
+  }
+  return 0;
+}
+
+// Instead of the actual font names we only output a unique font number.
+// Numbers are assigned by escaped font name for the whole document;
+// <pageFonts> remembers the number of each TextFontInfo on the current
+// page so the name is escaped and looked up once per font instead of
+// once per word.  TextFontInfo objects belong to the TextPage, so
+// <pageFonts> must be cleared before the page is deleted.
+struct FontTable {
+  std::map<std::string, int> names;
+  std::map<TextFontInfo *, int> pageFonts;
+};
+
+static int getFontNum(TextWord *word, FontTable &fonts) {
+  TextFontInfo *fontInfo = word->getFontInfo();
+  std::map<TextFontInfo *, int>::iterator cached;
+  std::map<std::string, int>::iterator it;
+  int num;
+
+  if (!fontInfo) {
+    return 0;
+  }
+  cached = fonts.pageFonts.find(fontInfo);
+  if (cached != fonts.pageFonts.end()) {
+    return cached->second;
+  }
+  num = 0;
+  if (fontInfo->getFontName()) {
+    const std::string fontName = escape_json(fontInfo->getFontName()->getCString());
+    fonts.names.insert(std::make_pair(fontName, fonts.names.size()));
+    it = fonts.names.find(fontName);
+    if (it != fonts.names.end()) {
+      num = it->second;
+    }
+  }
+  fonts.pageFonts[fontInfo] = num;
+  return num;
+}
+
+// Length of a UTF-8 string in UTF-16 code units, which is what
+// JavaScript consumers index strings by
+static int getUTF16Length(const char *s) {
+  int n = 0;
+  for (; *s; ++s) {
+    unsigned char c = (unsigned char)*s;
+    if ((c & 0xc0) != 0x80) {
+      ++n;
+      if (c >= 0xf0) {
+        ++n;
+      }
+    }
+  }
+  return n;
+}
+
+//------------------------------------------------------------------------
+// StringTable (-strtable)
+//------------------------------------------------------------------------
+
+// Words at least this long (in bytes) are interned.
+#define strTableMinLength 4
+
+// Approximate per-entry overhead, for the memory budget.
+#define strTableEntryOverhead 32
+
+// Once the table exceeds this many bytes it is cleared at the start
+// of the next page.
+#define strTableMaxBytes (8 << 20)
+
+// Interns word strings for the nested JSON layout.  Strings are
+// numbered in order of first use; an interned word is written as its
+// integer index, and each page lists the strings it added (in index
+// order) so the table can be rebuilt page by page.  Words shorter than
+// strTableMinLength are only interned when their whole line has
+// already been seen, which catches running headers and footers.
+class StringTable {
+public:
+
+  StringTable();
+  ~StringTable();
+
+  // Start a new page.  Clears the table if it has grown over budget;
+  // returns true if it was cleared.
+  GBool startPage();
+
+  // Start a new line; checks whether the same text has been seen
+  // before.
+  void startLine(GList *words);
+
+  // Return the index of <s>, adding it if needed, or -1 if <s> should
+  // be written inline.
+  int getIndex(const char *s);
+
+  // Strings added since the last startPage().
+  std::vector<std::string> &getNewStrings() { return newStrings; }
+
+private:
+
+  GHash *strings;		// string -> index + 1
+  GHash *lines;			// line text -> 1
+  int nStrings;
+  size_t bytes;
+  GBool repeatedLine;		// is the current line a repeat?
+  std::vector<std::string> newStrings;
+};
+
+StringTable::StringTable() {
+  strings = new GHash(gTrue);
+  lines = new GHash(gTrue);
+  nStrings = 0;
+  bytes = 0;
+  repeatedLine = gFalse;
+}
+
+StringTable::~StringTable() {
+  delete strings;
+  delete lines;
+}
+
+GBool StringTable::startPage() {
+  newStrings.clear();
+  if (bytes <= strTableMaxBytes) {
+    return gFalse;
+  }
+  delete strings;
+  delete lines;
+  strings = new GHash(gTrue);
+  lines = new GHash(gTrue);
+  nStrings = 0;
+  bytes = 0;
+  return gTrue;
+}
+
+void StringTable::startLine(GList *words) {
+  GString *key;
+  int i;
+
+  key = new GString();
+  for (i = 0; i < words->getLength(); ++i) {
+    if (i > 0) {
+      key->append('\n');
+    }
+    key->append(((TextWord *) words->get(i))->getText());
+  }
+  repeatedLine = lines->lookupInt(key) != 0;
+  if (repeatedLine) {
+    delete key;
+  } else {
+    bytes += key->getLength() + strTableEntryOverhead;
+    lines->add(key, 1);
+  }
+}
+
+int StringTable::getIndex(const char *s) {
+  int idx;
+
+  if ((idx = strings->lookupInt(s))) {
+    return idx - 1;
+  }
+  if (!repeatedLine && strlen(s) < strTableMinLength) {
+    return -1;
+  }
+  strings->add(new GString(s), nStrings + 1);
+  newStrings.push_back(s);
+  bytes += strlen(s) + strTableEntryOverhead;
+  return nStrings++;
+}
+
+//------------------------------------------------------------------------
+// compact coordinates (-quantize)
+//------------------------------------------------------------------------
+
+// Convert a coordinate to integer units of 1/quantizeGrid pt.
+static int quantizeCoord(double v) {
+  return (int)floor(v * quantizeGrid + 0.5);
+}
+
+// Per-line state for delta-encoding word coordinates.  The line's
+// yMin, yMax and baseline are written once with the line, and each
+// word stores its bbox as [xMin - previous word's xMax, width,
+// yMin - line yMin, yMax - line yMax] and its baseline relative to the
+// line baseline, all in quantized units.
+struct CompactLine {
+  int yMin, yMax, base;
+  int prevXMax;
+};
+
+static void initCompactLine(CompactLine *cl, GList *words) {
+  double xMin, yMin, xMax, yMax;
+  TextWord *word;
+
+  cl->yMin = cl->yMax = cl->base = 0;
+  cl->prevXMax = 0;
+  if (words->getLength() > 0) {
+    word = (TextWord *) words->get(0);
+    word->getBBox(&xMin, &yMin, &xMax, &yMax);
+    cl->yMin = quantizeCoord(yMin);
+    cl->yMax = quantizeCoord(yMax);
+    cl->base = quantizeCoord(word->getBaseline());
+  }
+}
+
+// If <cl> is not NULL, coordinates are written in compact form relative
+// to that line.  If <strTable> is not NULL, the text may be written as
+// a string table index.
+static void printWordJSON(FILE *f, TextWord *word, CompactLine *cl,
+                          StringTable *strTable,
+                          FontTable &fonts,
+                          std::map<std::string, int> &colors) {
+  double xMin, yMin, xMax, yMax;
+  int qxMin, qxMax;
+  TextFontInfo *fontInfo;
+  const char *sep;
+
+  if (wordFields == wordFieldAll && !cl && !strTable) {
+    word->getBBox(&xMin, &yMin, &xMax, &yMax);
+    const std::string myString = escape_json(word->getText()->getCString());
+    int color_nr = getColorNum(word, colors);
+    int font_nr = getFontNum(word, fonts);
+    fontInfo = word->getFontInfo();
+
+    fprintf(f,
+            "["
+                    "%g,"
+                    "%g,"
+                    "%g,"
+                    "%g,"
+                    "%g,"
+                    "%d,"
+                    "%g,"
+                    "%d,"
+                    "%d,"
+                    "%d,"
+                    "%d,"
+                    "%d,"
+                    "%d,"
+                    "\"%s\""
+                    "]",
+            xMin,
+            yMin,
+            xMax,
+            yMax,
+            word->getFontSize(),
+            word->getSpaceAfter(),
+            word->getBaseline(),
+            word->getRotation(),
+            word->isUnderlined(),
+            fontInfo ? fontInfo->isBold() : 0,
+            fontInfo ? fontInfo->isItalic() : 0,
+            color_nr,
+            font_nr,
+            myString.c_str()
+    );
+    return;
+  }
+
+  // only compute the selected attributes, in the same order as above
+  fontInfo = (wordFields & (wordFieldBold | wordFieldItalic))
+             ? word->getFontInfo() : (TextFontInfo *)NULL;
+  sep = "";
+  fprintf(f, "[");
+  if (wordFields & wordFieldBBox) {
+    word->getBBox(&xMin, &yMin, &xMax, &yMax);
+    if (cl) {
+      qxMin = quantizeCoord(xMin);
+      qxMax = quantizeCoord(xMax);
+      fprintf(f, "%d,%d,%d,%d", qxMin - cl->prevXMax, qxMax - qxMin,
+              quantizeCoord(yMin) - cl->yMin, quantizeCoord(yMax) - cl->yMax);
+      cl->prevXMax = qxMax;
+    } else {
+      fprintf(f, "%g,%g,%g,%g", xMin, yMin, xMax, yMax);
+    }
+    sep = ",";
+  }
+  if (wordFields & wordFieldFontSize) {
+    fprintf(f, "%s%g", sep, word->getFontSize());
+    sep = ",";
+  }
+  if (wordFields & wordFieldSpaceAfter) {
+    fprintf(f, "%s%d", sep, word->getSpaceAfter());
+    sep = ",";
+  }
+  if (wordFields & wordFieldBaseline) {
+    if (cl) {
+      fprintf(f, "%s%d", sep, quantizeCoord(word->getBaseline()) - cl->base);
+    } else {
+      fprintf(f, "%s%g", sep, word->getBaseline());
+    }
+    sep = ",";
+  }
+  if (wordFields & wordFieldRotation) {
+    fprintf(f, "%s%d", sep, word->getRotation());
+    sep = ",";
+  }
+  if (wordFields & wordFieldUnderlined) {
+    fprintf(f, "%s%d", sep, word->isUnderlined());
+    sep = ",";
+  }
+  if (wordFields & wordFieldBold) {
+    fprintf(f, "%s%d", sep, fontInfo ? fontInfo->isBold() : 0);
+    sep = ",";
+  }
+  if (wordFields & wordFieldItalic) {
+    fprintf(f, "%s%d", sep, fontInfo ? fontInfo->isItalic() : 0);
+    sep = ",";
+  }
+  if (wordFields & wordFieldColor) {
+    fprintf(f, "%s%d", sep, getColorNum(word, colors));
+    sep = ",";
+  }
+  if (wordFields & wordFieldFont) {
+    fprintf(f, "%s%d", sep, getFontNum(word, fonts));
+    sep = ",";
+  }
+  if (wordFields & wordFieldText) {
+    int idx = strTable ? strTable->getIndex(word->getText()->getCString()) : -1;
+    if (idx >= 0) {
+      fprintf(f, "%s%d", sep, idx);
+    } else {
+      fprintf(f, "%s\"%s\"", sep,
+              escape_json(word->getText()->getCString()).c_str());
+    }
+  }
+  fprintf(f, "]");
+}
+
+static void printLineJSON(FILE *f, GList *words, StringTable *strTable,
+                          FontTable &fonts,
+                          std::map<std::string, int> &colors) {
+  CompactLine compactLine;
+  CompactLine *cl;
+  int wordIdx;
+
+  cl = NULL;
+  if (quantizeGrid > 0) {
+    cl = &compactLine;
+    initCompactLine(cl, words);
+  }
+  if (strTable && (wordFields & wordFieldText)) {
+    strTable->startLine(words);
+  }
+  fprintf(f, "[[");
+  for (wordIdx = 0; wordIdx < words->getLength(); ++wordIdx) {
+    if (wordIdx > 0) fprintf(f, ",");
+    printWordJSON(f, (TextWord *) words->get(wordIdx), cl, strTable, fonts, colors);
+  }
+  if (cl) {
+    fprintf(f, "],%d,%d,%d]", cl->yMin, cl->yMax, cl->base);
+  } else {
+    fprintf(f, "]]");
+  }
+}
+
+static void printParagraphBoxJSON(FILE *f, double xMin, double yMin,
+                                  double xMax, double yMax) {
+  if (quantizeGrid > 0) {
+    fprintf(f, "%d,%d,%d,%d", quantizeCoord(xMin), quantizeCoord(yMin),
+            quantizeCoord(xMax), quantizeCoord(yMax));
+  } else {
+    fprintf(f, "%g,%g,%g,%g", xMin, yMin, xMax, yMax);
+  }
+}
+
+// Nested layout: columns > paragraphs > lines > words, one 14-element
+// array per word.  With -quantize, paragraph boxes are integers and
+// each line carries its shared yMin, yMax and baseline after the word
+// list.
+static void printPageNestedJSON(FILE *f, GList *cols, StringTable *strTable,
+                                FontTable &fonts,
+                                std::map<std::string, int> &colors) {
+  GList *pars, *lines;
+  TextColumn *col;
+  TextParagraph *par;
+  int colIdx, parIdx, lineIdx;
+
+  fprintf(f, "[");
+  bool firstF = true;
+  for (colIdx = 0; colIdx < cols->getLength(); ++colIdx) {
+    col = (TextColumn *) cols->get(colIdx);
+    if (firstF) firstF = false; else fprintf(f, ",");
+    fprintf(f, "[[");
+    bool firstB = true;
+    pars = col->getParagraphs();
+    for (parIdx = 0; parIdx < pars->getLength(); ++parIdx) {
+      par = (TextParagraph *) pars->get(parIdx);
+      if (firstB) firstB = false; else fprintf(f, ",");
+      // the fourth value has always been yMin in the uncompressed
+      // output, and is kept that way for existing consumers
+      fprintf(f, "[");
+      printParagraphBoxJSON(f, par->getXMin(), par->getYMin(), par->getXMax(),
+                            quantizeGrid > 0 ? par->getYMax() : par->getYMin());
+      fprintf(f, ",[");
+      bool firstL = true;
+      lines = par->getLines();
+      for (lineIdx = 0; lineIdx < lines->getLength(); ++lineIdx) {
+        if (firstL) firstL = false; else fprintf(f, ",");
+        printLineJSON(f, ((TextLine *) lines->get(lineIdx))->getWords(),
+                      strTable, fonts, colors);
+      }
+      fprintf(f, "]]");
+    }
+    fprintf(f, "]]");
+  }
+  fprintf(f, "]");
+}
+
+//------------------------------------------------------------------------
+// raw order (-raw)
+//------------------------------------------------------------------------
+
+// Split a content-stream-order word list into lines: a new line starts
+// whenever the rotation changes or the baseline moves by more than
+// half the font size.  Returns a list of GLists of (unowned)
+// TextWords.
+static GList *makeRawLines(TextWordList *wordList) {
+  GList *lines, *line;
+  TextWord *word, *prev;
+  double d;
+  int i;
+
+  lines = new GList();
+  line = NULL;
+  prev = NULL;
+  for (i = 0; i < wordList->getLength(); ++i) {
+    word = wordList->get(i);
+    if (prev) {
+      d = word->getBaseline() - prev->getBaseline();
+      if (word->getRotation() != prev->getRotation() ||
+          fabs(d) > 0.5 * (word->getFontSize() < prev->getFontSize()
+                           ? word->getFontSize() : prev->getFontSize())) {
+        line = NULL;
+      }
+    }
+    if (!line) {
+      line = new GList();
+      lines->append(line);
+    }
+    line->append(word);
+    prev = word;
+  }
+  return lines;
+}
+
+static void freeRawLines(GList *lines) {
+  int i;
+
+  for (i = 0; i < lines->getLength(); ++i) {
+    delete (GList *) lines->get(i);
+  }
+  delete lines;
+}
+
+static void getWordListBBox(TextWordList *wordList, double *xMin, double *yMin,
+                            double *xMax, double *yMax) {
+  double x0, y0, x1, y1;
+  int i;
+
+  *xMin = *yMin = *xMax = *yMax = 0;
+  for (i = 0; i < wordList->getLength(); ++i) {
+    wordList->get(i)->getBBox(&x0, &y0, &x1, &y1);
+    if (i == 0 || x0 < *xMin) *xMin = x0;
+    if (i == 0 || y0 < *yMin) *yMin = y0;
+    if (i == 0 || x1 > *xMax) *xMax = x1;
+    if (i == 0 || y1 > *yMax) *yMax = y1;
+  }
+}
+
+// Raw layout uses the same nesting as the reading-order layout, with
+// a single column holding a single paragraph.
+static void printPageRawNestedJSON(FILE *f, TextWordList *wordList,
+                                   GList *lines, StringTable *strTable,
+                                   FontTable &fonts,
+                                   std::map<std::string, int> &colors) {
+  double xMin, yMin, xMax, yMax;
+  int i;
+
+  if (!lines->getLength()) {
+    fprintf(f, "[]");
+    return;
+  }
+  getWordListBBox(wordList, &xMin, &yMin, &xMax, &yMax);
+  fprintf(f, "[[[[");
+  printParagraphBoxJSON(f, xMin, yMin, xMax, yMax);
+  fprintf(f, ",[");
+  for (i = 0; i < lines->getLength(); ++i) {
+    if (i > 0) fprintf(f, ",");
+    printLineJSON(f, (GList *) lines->get(i), strTable, fonts, colors);
+  }
+  fprintf(f, "]]]]]");
+}
+
+//------------------------------------------------------------------------
+// columnar layout (-columnar)
+//------------------------------------------------------------------------
+
+static void printIntArrayJSON(FILE *f, const char *key, std::vector<int> &a) {
+  fprintf(f, "\"%s\":[", key);
+  for (size_t i = 0; i < a.size(); ++i) {
+    fprintf(f, i ? ",%d" : "%d", a[i]);
+  }
+  fprintf(f, "]");
+}
+
+static void printNumArrayJSON(FILE *f, const char *key, std::vector<double> &a) {
+  fprintf(f, "\"%s\":[", key);
+  for (size_t i = 0; i < a.size(); ++i) {
+    fprintf(f, i ? ",%g" : "%g", a[i]);
+  }
+  fprintf(f, "]");
+}
+
+// Like printNumArrayJSON, but writes quantized integers with -quantize.
+static void printCoordArrayJSON(FILE *f, const char *key, std::vector<double> &a) {
+  if (quantizeGrid <= 0) {
+    printNumArrayJSON(f, key, a);
+    return;
+  }
+  fprintf(f, "\"%s\":[", key);
+  for (size_t i = 0; i < a.size(); ++i) {
+    fprintf(f, i ? ",%d" : "%d", quantizeCoord(a[i]));
+  }
+  fprintf(f, "]");
+}
+
+// Columnar layout: one array per word attribute, word strings
+// concatenated into a single string with an offsets array (in UTF-16
+// code units, n+1 entries), and the column/paragraph/line structure
+// encoded as run lengths (paragraphs per column, lines per paragraph,
+// words per line).  With -quantize, coordinates are absolute integers.
+struct ColumnarPage {
+  std::vector<double> xMins, yMins, xMaxs, yMaxs, fontSizes, baselines;
+  std::vector<double> parBoxes;
+  std::vector<int> spaceAfters, rotations, underlines, bolds, italics;
+  std::vector<int> colorNums, fontNums, offsets;
+  std::vector<int> colLens, parLens, lineLens;
+  std::string text;
+  int offset;
+
+  ColumnarPage(): offset(0) {}
+  void addParagraph(double xMin, double yMin, double xMax, double yMax,
+                    int nLines);
+  void addLine(GList *words, FontTable &fonts,
+               std::map<std::string, int> &colors);
+  void print(FILE *f);
+};
+
+void ColumnarPage::addParagraph(double xMin, double yMin,
+                                double xMax, double yMax, int nLines) {
+  parBoxes.push_back(xMin);
+  parBoxes.push_back(yMin);
+  parBoxes.push_back(xMax);
+  parBoxes.push_back(yMax);
+  parLens.push_back(nLines);
+}
+
+void ColumnarPage::addLine(GList *words, FontTable &fonts,
+                           std::map<std::string, int> &colors) {
+  TextWord *word;
+  TextFontInfo *fontInfo;
+  double xMin, yMin, xMax, yMax;
+  int wordIdx;
+
+  lineLens.push_back(words->getLength());
+  for (wordIdx = 0; wordIdx < words->getLength(); ++wordIdx) {
+    word = (TextWord *) words->get(wordIdx);
+    if (wordFields & wordFieldBBox) {
+      word->getBBox(&xMin, &yMin, &xMax, &yMax);
+      xMins.push_back(xMin);
+      yMins.push_back(yMin);
+      xMaxs.push_back(xMax);
+      yMaxs.push_back(yMax);
+    }
+    if (wordFields & wordFieldFontSize) {
+      fontSizes.push_back(word->getFontSize());
+    }
+    if (wordFields & wordFieldSpaceAfter) {
+      spaceAfters.push_back(word->getSpaceAfter());
+    }
+    if (wordFields & wordFieldBaseline) {
+      baselines.push_back(word->getBaseline());
+    }
+    if (wordFields & wordFieldRotation) {
+      rotations.push_back(word->getRotation());
+    }
+    if (wordFields & wordFieldUnderlined) {
+      underlines.push_back(word->isUnderlined());
+    }
+    if (wordFields & (wordFieldBold | wordFieldItalic)) {
+      fontInfo = word->getFontInfo();
+      bolds.push_back(fontInfo ? fontInfo->isBold() : 0);
+      italics.push_back(fontInfo ? fontInfo->isItalic() : 0);
+    }
+    if (wordFields & wordFieldColor) {
+      colorNums.push_back(getColorNum(word, colors));
+    }
+    if (wordFields & wordFieldFont) {
+      fontNums.push_back(getFontNum(word, fonts));
+    }
+    if (wordFields & wordFieldText) {
+      offsets.push_back(offset);
+      text += word->getText()->getCString();
+      offset += getUTF16Length(word->getText()->getCString());
+    }
+  }
+}
+
+void ColumnarPage::print(FILE *f) {
+  fprintf(f, "{");
+  if (wordFields & wordFieldBBox) {
+    printCoordArrayJSON(f, "xMin", xMins);
+    fprintf(f, ",");
+    printCoordArrayJSON(f, "yMin", yMins);
+    fprintf(f, ",");
+    printCoordArrayJSON(f, "xMax", xMaxs);
+    fprintf(f, ",");
+    printCoordArrayJSON(f, "yMax", yMaxs);
+    fprintf(f, ",");
+  }
+  if (wordFields & wordFieldFontSize) {
+    printNumArrayJSON(f, "fontSize", fontSizes);
+    fprintf(f, ",");
+  }
+  if (wordFields & wordFieldSpaceAfter) {
+    printIntArrayJSON(f, "spaceAfter", spaceAfters);
+    fprintf(f, ",");
+  }
+  if (wordFields & wordFieldBaseline) {
+    printCoordArrayJSON(f, "baseline", baselines);
+    fprintf(f, ",");
+  }
+  if (wordFields & wordFieldRotation) {
+    printIntArrayJSON(f, "rotation", rotations);
+    fprintf(f, ",");
+  }
+  if (wordFields & wordFieldUnderlined) {
+    printIntArrayJSON(f, "underlined", underlines);
+    fprintf(f, ",");
+  }
+  if (wordFields & wordFieldBold) {
+    printIntArrayJSON(f, "bold", bolds);
+    fprintf(f, ",");
+  }
+  if (wordFields & wordFieldItalic) {
+    printIntArrayJSON(f, "italic", italics);
+    fprintf(f, ",");
+  }
+  if (wordFields & wordFieldColor) {
+    printIntArrayJSON(f, "color", colorNums);
+    fprintf(f, ",");
+  }
+  if (wordFields & wordFieldFont) {
+    printIntArrayJSON(f, "font", fontNums);
+    fprintf(f, ",");
+  }
+  if (wordFields & wordFieldText) {
+    offsets.push_back(offset);
+    fprintf(f, "\"text\":\"%s\",", escape_json(text).c_str());
+    printIntArrayJSON(f, "offsets", offsets);
+    fprintf(f, ",");
+  }
+  printIntArrayJSON(f, "columns", colLens);
+  fprintf(f, ",");
+  printIntArrayJSON(f, "paragraphs", parLens);
+  fprintf(f, ",");
+  printIntArrayJSON(f, "lines", lineLens);
+  fprintf(f, ",");
+  printCoordArrayJSON(f, "paragraphBoxes", parBoxes);
+  fprintf(f, "}");
+}
+
+static void printPageColumnarJSON(FILE *f, GList *cols,
+                                  FontTable &fonts,
+                                  std::map<std::string, int> &colors) {
+  ColumnarPage cp;
+  GList *pars, *lines;
+  TextColumn *col;
+  TextParagraph *par;
+  int colIdx, parIdx, lineIdx;
+
+  for (colIdx = 0; colIdx < cols->getLength(); ++colIdx) {
+    col = (TextColumn *) cols->get(colIdx);
+    pars = col->getParagraphs();
+    cp.colLens.push_back(pars->getLength());
+    for (parIdx = 0; parIdx < pars->getLength(); ++parIdx) {
+      par = (TextParagraph *) pars->get(parIdx);
+      lines = par->getLines();
+      cp.addParagraph(par->getXMin(), par->getYMin(),
+                      par->getXMax(), par->getYMax(), lines->getLength());
+      for (lineIdx = 0; lineIdx < lines->getLength(); ++lineIdx) {
+        cp.addLine(((TextLine *) lines->get(lineIdx))->getWords(),
+                   fonts, colors);
+      }
+    }
+  }
+  cp.print(f);
+}
+
+static void printPageRawColumnarJSON(FILE *f, TextWordList *wordList,
+                                     GList *lines,
+                                     FontTable &fonts,
+                                     std::map<std::string, int> &colors) {
+  ColumnarPage cp;
+  double xMin, yMin, xMax, yMax;
+  int i;
+
+  if (lines->getLength()) {
+    getWordListBBox(wordList, &xMin, &yMin, &xMax, &yMax);
+    cp.colLens.push_back(1);
+    cp.addParagraph(xMin, yMin, xMax, yMax, lines->getLength());
+    for (i = 0; i < lines->getLength(); ++i) {
+      cp.addLine((GList *) lines->get(i), fonts, colors);
+    }
+  }
+  cp.print(f);
+}
+
+//------------------------------------------------------------------------
+// page prefetch (-prefetch)
+//------------------------------------------------------------------------
+
+// Bytes hinted at the start of an object whose length isn't known.
+#define prefetchObjWindow 4096
+
+// Stop after hinting this many objects for one page.
+#define prefetchMaxObjects 512
+
+// Second handle on the input file, used only for readahead hints.
+// The OS cache is shared, so the hints also serve PDFDoc's reads.
+static FILE *prefetchFile = NULL;
+
+// Objects of the next page that have been hinted but not fetched yet.
+static std::vector<Ref> prefetchRefs;
+static std::set<int> prefetchSeen;
+
+// Collect the indirect references in <obj>, looking into direct
+// dictionaries and arrays.  /Parent is skipped so the walk stays
+// within the page.
+static void collectPrefetchRefs(Object *obj, int depth) {
+  Object val;
+  int i;
+
+  if (obj->isRef()) {
+    if ((int)prefetchSeen.size() < prefetchMaxObjects &&
+        prefetchSeen.insert(obj->getRef().num).second) {
+      prefetchRefs.push_back(obj->getRef());
+    }
+  } else if (depth > 0 && obj->isDict()) {
+    for (i = 0; i < obj->getDict()->getLength(); ++i) {
+      if (!strcmp(obj->getDict()->getKey(i), "Parent")) {
+        continue;
+      }
+      collectPrefetchRefs(obj->getDict()->getValNF(i, &val), depth - 1);
+      val.free();
+    }
+  } else if (depth > 0 && obj->isArray()) {
+    for (i = 0; i < obj->getArray()->getLength(); ++i) {
+      collectPrefetchRefs(obj->getArray()->getNF(i, &val), depth - 1);
+      val.free();
+    }
+  }
+}
+
+// Hint the first bytes of the objects in prefetchRefs, using their
+// xref offsets.  Nothing is read here.
+static void hintPrefetchRefs(XRef *xref) {
+  XRefEntry *entry;
+  size_t i;
+
+  for (i = 0; i < prefetchRefs.size(); ++i) {
+    if (prefetchRefs[i].num < 0 ||
+        prefetchRefs[i].num >= xref->getNumObjects()) {
+      continue;
+    }
+    entry = xref->getEntry(prefetchRefs[i].num);
+    if (entry->type == xrefEntryCompressed) {
+      // hint the start of the containing object stream
+      if (entry->offset < 0 || entry->offset >= xref->getNumObjects()) {
+        continue;
+      }
+      entry = xref->getEntry((int)entry->offset);
+    }
+    if (entry->type == xrefEntryUncompressed) {
+      gfprefetch(prefetchFile, entry->offset, prefetchObjWindow);
+    }
+  }
+}
+
+// Hint the body of stream <obj>.
+static void hintPrefetchStream(Object *obj) {
+  BaseStream *baseStr;
+  Object len;
+
+  if (!(baseStr = obj->getStream()->getBaseStream())) {
+    return;
+  }
+  obj->streamGetDict()->lookup("Length", &len);
+  gfprefetch(prefetchFile, baseStr->getStart(),
+             len.isInt() && len.getInt() > 0 ? len.getInt()
+                                             : prefetchObjWindow);
+  len.free();
+}
+
+// Prefetch works in two steps around the interpretation of the
+// current page, so the reads it triggers never hold that page up:
+//
+// startPrefetch(), called before the current page is displayed, hints
+// the next page's content streams and the objects its resources refer
+// to (fonts, XObjects, ...), from their xref offsets.  Apart from a
+// single Contents stream's dictionary, nothing is fetched.
+//
+// advancePrefetch(), called once the current page has been
+// interpreted, fetches those objects (whose reads had the whole page
+// to complete), and hints the stream bodies and the objects they
+// refer to (font descriptors, ToUnicode maps, form resources).  Those
+// load while the current page's JSON is laid out and written, or
+// while the next page reads its first objects.  Anything deeper (e.g.
+// embedded font programs) is left to the interpreter.  The fetched
+// objects are thrown away, so the interpreter parses them again.
+// That parse works on cached bytes and is the accepted cost of
+// finding stream bodies and the next level of references.
+static void startPrefetch(PDFDoc *doc, int pg) {
+  Page *page;
+  Object obj;
+
+  prefetchRefs.clear();
+  prefetchSeen.clear();
+  if (!prefetchFile || !(page = doc->getCatalog()->getPage(pg))) {
+    return;
+  }
+  page->getContents(&obj);
+  if (obj.isStream()) {
+    hintPrefetchStream(&obj);
+  } else {
+    collectPrefetchRefs(&obj, 1);
+  }
+  obj.free();
+  if (page->getResourceDict()) {
+    obj.initDict(page->getResourceDict());
+    collectPrefetchRefs(&obj, 2);
+    obj.free();
+  }
+  hintPrefetchRefs(doc->getXRef());
+}
+
+static void advancePrefetch(PDFDoc *doc) {
+  XRef *xref;
+  std::vector<Ref> refs;
+  Object obj, dictObj, subtype;
+  size_t i;
+
+  if (prefetchRefs.empty()) {
+    return;
+  }
+  xref = doc->getXRef();
+  refs.swap(prefetchRefs);
+  for (i = 0; i < refs.size(); ++i) {
+    xref->fetch(refs[i].num, refs[i].gen, &obj);
+    if (obj.isStream()) {
+      // image data is never read for text extraction
+      obj.streamGetDict()->lookup("Subtype", &subtype);
+      if (!subtype.isName("Image")) {
+        hintPrefetchStream(&obj);
+        dictObj.initDict(obj.streamGetDict());
+        collectPrefetchRefs(&dictObj, 3);
+        dictObj.free();
+      }
+      subtype.free();
+    } else {
+      collectPrefetchRefs(&obj, 3);
+    }
+    obj.free();
+  }
+  hintPrefetchRefs(xref);
+  prefetchRefs.clear();
+}
+
+//------------------------------------------------------------------------
+// per-page budgets (-maxchars, -pagetimeout)
+//------------------------------------------------------------------------
+
+// A page over budget in reading order is redone in raw order, which
+// gets this many times the character budget before it is truncated.
+#define rawCharsFactor 4
+
+// Fallback applied to a page that went over budget.
+enum PageFallback {
+  pageFallbackNone,
+  pageFallbackRaw,		// layout analysis skipped
+  pageFallbackTruncated		// interpretation cut short
+};
+
+static const char *pageFallbackNames[] = {
+  NULL,
+  "raw",
+  "truncated"
+};
+
+// Wall clock time in seconds.
+static double getWallTime() {
+#ifdef _WIN32
+  return GetTickCount() / 1000.0;
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+}
+
+// Whole-document deadline from -timeout, or 0 for none.
+static double docDeadline = 0;
+
+// The earlier of two deadlines, where 0 means none.
+static double minDeadline(double d1, double d2) {
+  if (d1 <= 0) {
+    return d2;
+  }
+  if (d2 <= 0) {
+    return d1;
+  }
+  return d1 < d2 ? d1 : d2;
+}
+
+// Size of the buffer used to skip inline image data.
+#define skipImageBufSize 4096
+
+// TextOutputDev that stops collecting characters over a budget and
+// lets displayPage abort once the budget or a deadline is exceeded.
+// In text-only mode it also skips inline image data by its raw length
+// (or in blocks, instead of a byte at a time), and takes over shaded
+// fills so Gfx doesn't break 'sh' shadings down into thousands of
+// small fills.
+class JSONTextOutputDev: public TextOutputDev {
+public:
+
+  JSONTextOutputDev(TextOutputControl *controlA):
+    TextOutputDev(NULL, controlA, gFalse), textOnly(gFalse)
+    { setBudget(0, 0); }
+
+  void setTextOnly(GBool textOnlyA) { textOnly = textOnlyA; }
+
+  virtual void drawImageMask(GfxState *state, Object *ref, Stream *str,
+                             int width, int height, GBool invert,
+                             GBool inlineImg, GBool interpolate);
+  virtual void drawImage(GfxState *state, Object *ref, Stream *str,
+                         int width, int height, GfxImageColorMap *colorMap,
+                         int *maskColors, GBool inlineImg, GBool interpolate);
+  virtual GBool useShadedFills(int type)
+    { return textOnly || TextOutputDev::useShadedFills(type); }
+  virtual GBool shadedFill(GfxState *state, GfxShading *shading)
+    { return textOnly || TextOutputDev::shadedFill(state, shading); }
+
+  // Set the budget for the next page.  Zero means no limit.
+  void setBudget(int maxCharsA, double deadlineA);
+
+  virtual void drawChar(GfxState *state, double x, double y,
+                        double dx, double dy,
+                        double originX, double originY,
+                        CharCode c, int nBytes, Unicode *u, int uLen,
+                        GBool fill, GBool stroke, GBool makePath);
+
+  GBool charLimitHit() { return charLimit > 0 && nChars > charLimit; }
+  GBool deadlineHit() { return timedOut; }
+
+  // Abort callback for PDFDoc::displayPage; <data> is the
+  // JSONTextOutputDev.
+  static GBool abortCheck(void *data);
+
+private:
+
+  void skipInlineImage(Stream *str, int nBytes);
+
+  GBool textOnly;
+
+  int charLimit;
+  int nChars;
+  double deadline;
+  GBool timedOut;
+};
+
+void JSONTextOutputDev::setBudget(int maxCharsA, double deadlineA) {
+  charLimit = maxCharsA;
+  deadline = deadlineA;
+  nChars = 0;
+  timedOut = gFalse;
+}
+
+void JSONTextOutputDev::drawChar(GfxState *state, double x, double y,
+                                 double dx, double dy,
+                                 double originX, double originY,
+                                 CharCode c, int nBytes, Unicode *u, int uLen,
+                                 GBool fill, GBool stroke, GBool makePath) {
+  if (charLimit > 0 && ++nChars > charLimit) {
+    return;
+  }
+  TextOutputDev::drawChar(state, x, y, dx, dy, originX, originY,
+                          c, nBytes, u, uLen, fill, stroke, makePath);
+}
+
+void JSONTextOutputDev::drawImageMask(GfxState *state, Object *ref,
+                                      Stream *str, int width, int height,
+                                      GBool invert, GBool inlineImg,
+                                      GBool interpolate) {
+  if (!textOnly) {
+    TextOutputDev::drawImageMask(state, ref, str, width, height, invert,
+                                 inlineImg, interpolate);
+  } else if (inlineImg) {
+    skipInlineImage(str, height * ((width + 7) / 8));
+  }
+}
+
+void JSONTextOutputDev::drawImage(GfxState *state, Object *ref, Stream *str,
+                                  int width, int height,
+                                  GfxImageColorMap *colorMap,
+                                  int *maskColors, GBool inlineImg,
+                                  GBool interpolate) {
+  if (!textOnly) {
+    TextOutputDev::drawImage(state, ref, str, width, height, colorMap,
+                             maskColors, inlineImg, interpolate);
+  } else if (inlineImg) {
+    skipInlineImage(str, height * ((width * colorMap->getNumPixelComps() *
+                                    colorMap->getBits() + 7) / 8));
+  }
+}
+
+// Inline image data has to be consumed so Gfx can find the EI that
+// follows it.  If the image dictionary gives the raw data length (/L,
+// PDF 2.0), that many bytes are skipped in the content stream without
+// decoding; otherwise the decoded data (<nBytes>) is read through the
+// filters in blocks.  Image XObjects never get here: TextOutputDev's
+// needNonText() already makes Gfx skip them.
+void JSONTextOutputDev::skipInlineImage(Stream *str, int nBytes) {
+  char buf[skipImageBufSize];
+  Stream *rawStr;
+  Object len;
+  int n;
+
+  len.initNull();
+  if (str->getDict()) {
+    str->getDict()->lookup("L", &len);
+    if (!len.isInt()) {
+      len.free();
+      str->getDict()->lookup("Length", &len);
+    }
+  }
+  if (len.isInt() && len.getInt() >= 0 &&
+      (rawStr = str->getUndecodedStream())) {
+    nBytes = len.getInt();
+    len.free();
+    while (nBytes > 0) {
+      n = rawStr->getBlock(buf, nBytes < skipImageBufSize ? nBytes
+                                                          : skipImageBufSize);
+      if (n <= 0) {
+        break;
+      }
+      nBytes -= n;
+    }
+    return;
+  }
+  len.free();
+
+  str->reset();
+  while (nBytes > 0) {
+    n = str->getBlock(buf, nBytes < skipImageBufSize ? nBytes
+                                                     : skipImageBufSize);
+    if (n <= 0) {
+      break;
+    }
+    nBytes -= n;
+  }
+  str->close();
 }
 
-static void printInfoJSON(FILE *f, Dict *infoDict, UnicodeMap *uMap) {
-  GString *s1;
-  GBool isUnicode;
-  Unicode u;
-  char buf[9];
-  int i, n;
+GBool JSONTextOutputDev::abortCheck(void *data) {
+  JSONTextOutputDev *dev = (JSONTextOutputDev *)data;
 
-  bool firstE = true;
-  for (int k = 0; k < infoDict->getLength(); k++) {
-    const std::string keyStr = escape_json(infoDict->getKey(k));
-    if (!keyStr.length()) continue;
-    Object obj;
-    infoDict->getVal(k, &obj);
-    if (obj.isString()) {
-      if (firstE) firstE = false; else fprintf(f, ",");
-      s1 = obj.getString();
-      if ((s1->getChar(0) & 0xff) == 0xfe &&
-          (s1->getChar(1) & 0xff) == 0xff) {
-        isUnicode = gTrue;
-        i = 2;
-      } else {
-        isUnicode = gFalse;
-        i = 0;
+  if (dev->charLimitHit()) {
+    return gTrue;
+  }
+  if (dev->deadline > 0 && getWallTime() > dev->deadline) {
+    dev->timedOut = gTrue;
+    return gTrue;
+  }
+  return gFalse;
+}
+
+// Interpret one page, applying the per-page budgets and the document
+// deadline.  Pages over budget in reading order (or taking more than
+// half the time budget) are redone in raw order with <rawTextOut>;
+// pages still over budget, or cut off by the document deadline, keep
+// whatever was collected and are marked truncated.  Returns the
+// TextPage and sets *<fallback>; *<rawText> is set if the TextPage
+// came from <rawTextOut>.  A page truncated in reading order is still
+// a reading-order TextPage.
+static TextPage *displayPageJSON(PDFDoc *doc, int page,
+                                 JSONTextOutputDev *textOut,
+                                 JSONTextOutputDev *rawTextOut,
+                                 PageFallback *fallback, GBool *rawText) {
+  JSONTextOutputDev *dev;
+  double start, pageDeadline;
+  TextPage *text;
+
+  *fallback = pageFallbackNone;
+  *rawText = gFalse;
+  if (maxChars <= 0 && pageTimeout <= 0 && docDeadline <= 0) {
+    doc->displayPage(textOut, page, 72, 72, 0, gTrue, gFalse, gFalse);
+    return textOut->takeText();
+  }
+
+  start = getWallTime();
+  pageDeadline = minDeadline(pageTimeout > 0 ? start + pageTimeout : 0,
+                             docDeadline);
+  dev = textOut;
+  if (rawTextOut) {
+    textOut->setBudget(maxChars,
+                       minDeadline(pageTimeout > 0 ? start + 0.5 * pageTimeout : 0,
+                                   docDeadline));
+    doc->displayPage(textOut, page, 72, 72, 0, gTrue, gFalse, gFalse,
+                     &JSONTextOutputDev::abortCheck, textOut);
+    text = textOut->takeText();
+    if (!textOut->charLimitHit() && !textOut->deadlineHit()) {
+      return text;
+    }
+    if (textOut->deadlineHit() && docDeadline > 0 &&
+        getWallTime() > docDeadline) {
+      // no time left to redo the page
+      *fallback = pageFallbackTruncated;
+      return text;
+    }
+    delete text;
+    *fallback = pageFallbackRaw;
+    *rawText = gTrue;
+    dev = rawTextOut;
+    dev->setBudget(maxChars > 0 ? rawCharsFactor * maxChars : 0, pageDeadline);
+  } else {
+    dev->setBudget(maxChars, pageDeadline);
+  }
+  doc->displayPage(dev, page, 72, 72, 0, gTrue, gFalse, gFalse,
+                   &JSONTextOutputDev::abortCheck, dev);
+  if (dev->charLimitHit() || dev->deadlineHit()) {
+    *fallback = pageFallbackTruncated;
+  }
+  return dev->takeText();
+}
+
+//------------------------------------------------------------------------
+// ContentProbe (-probe)
+//------------------------------------------------------------------------
+
+#define maxProbeArgs 33
+#define maxProbeFormDepth 20
+
+// Counts text-showing and image operators in a page's content streams
+// (and the form XObjects they draw) without running Gfx or building a
+// TextPage.  Glyphs are counted as string bytes, halved for Type 0
+// fonts, which is exact for the usual 1- and 2-byte encodings.
+class ContentProbe {
+public:
+
+  ContentProbe(XRef *xrefA);
+
+  // Scan <contents> (a stream or an array of streams) with resources
+  // <resDict>.
+  void scan(Object *contents, Dict *resDict);
+
+  int glyphs;			// visible glyphs
+  int invisibleGlyphs;		// glyphs drawn with render mode 3 or 7
+  int images;			// image XObjects drawn
+  int inlineImages;
+
+private:
+
+  void execOp(const char *cmd, Object *args, int numArgs,
+              Dict *resDict, Parser *parser);
+  void skipInlineImage(Stream *str, Object *args, int numArgs);
+  void addGlyphs(Object *str);
+  void doXObject(const char *name, Dict *resDict);
+
+  XRef *xref;
+  int renderMode;
+  int bytesPerGlyph;
+  std::vector<int> stateStack;	// renderMode, bytesPerGlyph pairs
+  std::vector<Ref> formStack;	// forms being scanned, to stop loops
+};
+
+ContentProbe::ContentProbe(XRef *xrefA) {
+  xref = xrefA;
+  glyphs = invisibleGlyphs = images = inlineImages = 0;
+  renderMode = 0;
+  bytesPerGlyph = 1;
+}
+
+void ContentProbe::scan(Object *contents, Dict *resDict) {
+  Parser *parser;
+  Object obj;
+  Object args[maxProbeArgs];
+  int numArgs, i;
+
+  if (!contents->isStream() && !contents->isArray()) {
+    return;
+  }
+  parser = new Parser(xref, new Lexer(xref, contents), gFalse);
+  numArgs = 0;
+  parser->getObj(&obj);
+  while (!obj.isEOF()) {
+    if (obj.isCmd()) {
+      execOp(obj.getCmd(), args, numArgs, resDict, parser);
+      obj.free();
+      for (i = 0; i < numArgs; ++i) {
+        args[i].free();
       }
-      std::string valueStr = "";
-      while (i < obj.getString()->getLength()) {
-        if (isUnicode) {
-          u = ((s1->getChar(i) & 0xff) << 8) |
-              (s1->getChar(i + 1) & 0xff);
-          i += 2;
-        } else {
-          u = pdfDocEncoding[s1->getChar(i) & 0xff];
-          ++i;
+      numArgs = 0;
+    } else if (numArgs < maxProbeArgs) {
+      args[numArgs++] = obj;
+    } else {
+      obj.free();
+    }
+    parser->getObj(&obj);
+  }
+  obj.free();
+  for (i = 0; i < numArgs; ++i) {
+    args[i].free();
+  }
+  delete parser;
+}
+
+// Operands are taken from the end of the argument list, which is
+// robust against stray leading operands.
+void ContentProbe::execOp(const char *cmd, Object *args, int numArgs,
+                          Dict *resDict, Parser *parser) {
+  Object fontDict, font, subtype;
+  Stream *str;
+  int i;
+
+  if (!strcmp(cmd, "Tj") || !strcmp(cmd, "'") || !strcmp(cmd, "\"")) {
+    if (numArgs >= 1) {
+      addGlyphs(&args[numArgs - 1]);
+    }
+  } else if (!strcmp(cmd, "TJ")) {
+    if (numArgs >= 1 && args[numArgs - 1].isArray()) {
+      for (i = 0; i < args[numArgs - 1].arrayGetLength(); ++i) {
+        args[numArgs - 1].arrayGet(i, &font);
+        addGlyphs(&font);
+        font.free();
+      }
+    }
+  } else if (!strcmp(cmd, "Tf")) {
+    bytesPerGlyph = 1;
+    if (numArgs >= 2 && args[numArgs - 2].isName() && resDict) {
+      if (resDict->lookup("Font", &fontDict)->isDict() &&
+          fontDict.dictLookup(args[numArgs - 2].getName(), &font)->isDict() &&
+          font.dictLookup("Subtype", &subtype)->isName("Type0")) {
+        bytesPerGlyph = 2;
+      }
+      subtype.free();
+      font.free();
+      fontDict.free();
+    }
+  } else if (!strcmp(cmd, "Tr")) {
+    if (numArgs >= 1 && args[numArgs - 1].isInt()) {
+      renderMode = args[numArgs - 1].getInt();
+    }
+  } else if (!strcmp(cmd, "q")) {
+    stateStack.push_back(renderMode);
+    stateStack.push_back(bytesPerGlyph);
+  } else if (!strcmp(cmd, "Q")) {
+    if (stateStack.size() >= 2) {
+      bytesPerGlyph = stateStack.back();
+      stateStack.pop_back();
+      renderMode = stateStack.back();
+      stateStack.pop_back();
+    }
+  } else if (!strcmp(cmd, "Do")) {
+    if (numArgs >= 1 && args[numArgs - 1].isName()) {
+      doXObject(args[numArgs - 1].getName(), resDict);
+    }
+  } else if (!strcmp(cmd, "ID")) {
+    ++inlineImages;
+    if ((str = parser->getStream())) {
+      skipInlineImage(str, args, numArgs);
+    }
+  }
+}
+
+// Value of inline image key <key> (or its abbreviation <abbrev>) among
+// the BI ... ID operands, or NULL.
+static Object *getInlineImageArg(Object *args, int numArgs,
+                                 const char *key, const char *abbrev) {
+  int i;
+
+  for (i = 0; i + 1 < numArgs; i += 2) {
+    if (args[i].isName(key) || args[i].isName(abbrev)) {
+      return &args[i + 1];
+    }
+  }
+  return NULL;
+}
+
+// Number of components of inline image color space <cs>, or 0 if it
+// can't be told without the resources.
+static int getInlineImageComps(Object *cs) {
+  Object obj;
+  int comps;
+
+  if (!cs) {
+    return 0;
+  }
+  if (cs->isName("G") || cs->isName("DeviceGray") || cs->isName("CalGray")) {
+    return 1;
+  }
+  if (cs->isName("RGB") || cs->isName("DeviceRGB") || cs->isName("CalRGB")) {
+    return 3;
+  }
+  if (cs->isName("CMYK") || cs->isName("DeviceCMYK")) {
+    return 4;
+  }
+  comps = 0;
+  if (cs->isArray() && cs->arrayGetLength() > 0) {
+    cs->arrayGet(0, &obj);
+    if (obj.isName("I") || obj.isName("Indexed")) {
+      comps = 1;
+    }
+    obj.free();
+  }
+  return comps;
+}
+
+// PDF whitespace, as required after an EI operator.
+static GBool isInlineImageSpace(int c) {
+  return c == 0 || (c > 0 && strchr(" \t\n\f\r", c) != NULL);
+}
+
+// Whitespace or delimiter, as allowed before an EI operator.
+static GBool isInlineImageDelim(int c) {
+  return isInlineImageSpace(c) ||
+         (c > 0 && strchr("()<>[]{}/%", c) != NULL);
+}
+
+// Skip inline image data up to and including its EI.  Binary image
+// data can contain "EI", so when the size of the data is known (from
+// /L, or from W, H, BPC and the color space for unfiltered data) it is
+// skipped first.  The EI search that follows (the only means when the
+// size is unknown) accepts only an EI with whitespace or a delimiter
+// before it and whitespace or EOF after it.
+void ContentProbe::skipInlineImage(Stream *str, Object *args, int numArgs) {
+  char buf[skipImageBufSize];
+  Object *obj;
+  int width, height, bits, comps, n, prev, c1, c2, c3;
+  long long size;
+
+  size = 0;
+  if ((obj = getInlineImageArg(args, numArgs, "Length", "L")) &&
+      obj->isInt() && obj->getInt() > 0) {
+    size = obj->getInt();
+  } else if (!getInlineImageArg(args, numArgs, "Filter", "F") &&
+             (obj = getInlineImageArg(args, numArgs, "Width", "W")) &&
+             obj->isInt() && (width = obj->getInt()) > 0 &&
+             (obj = getInlineImageArg(args, numArgs, "Height", "H")) &&
+             obj->isInt() && (height = obj->getInt()) > 0) {
+    if ((obj = getInlineImageArg(args, numArgs, "ImageMask", "IM")) &&
+        obj->isBool() && obj->getBool()) {
+      comps = bits = 1;
+    } else {
+      obj = getInlineImageArg(args, numArgs, "BitsPerComponent", "BPC");
+      bits = obj && obj->isInt() ? obj->getInt() : 0;
+      comps = getInlineImageComps(getInlineImageArg(args, numArgs,
+                                                    "ColorSpace", "CS"));
+    }
+    if (bits > 0 && bits <= 16 && comps > 0) {
+      size = (long long)height * (((long long)width * comps * bits + 7) / 8);
+    }
+  }
+  while (size > 0) {
+    n = str->getBlock(buf, size < skipImageBufSize ? (int)size
+                                                   : skipImageBufSize);
+    if (n <= 0) {
+      return;
+    }
+    size -= n;
+  }
+
+  prev = ' ';
+  c1 = str->getChar();
+  c2 = str->getChar();
+  while (c2 != EOF) {
+    if (c1 == 'E' && c2 == 'I' && isInlineImageDelim(prev)) {
+      c3 = str->getChar();
+      if (c3 == EOF || isInlineImageSpace(c3)) {
+        return;
+      }
+      prev = c2;
+      c1 = c3;
+    } else {
+      prev = c1;
+      c1 = c2;
+    }
+    c2 = str->getChar();
+  }
+}
+
+void ContentProbe::addGlyphs(Object *str) {
+  int n;
+
+  if (!str->isString()) {
+    return;
+  }
+  n = str->getString()->getLength() / bytesPerGlyph;
+  if (renderMode == 3 || renderMode == 7) {
+    invisibleGlyphs += n;
+  } else {
+    glyphs += n;
+  }
+}
+
+void ContentProbe::doXObject(const char *name, Dict *resDict) {
+  Object xObjDict, xObj, xObjRef, subtype, formRes;
+  int savedRenderMode, savedBytesPerGlyph;
+  GBool loop;
+  Ref ref;
+  size_t i;
+
+  if (!resDict || !resDict->lookup("XObject", &xObjDict)->isDict()) {
+    xObjDict.free();
+    return;
+  }
+  xObjDict.dictLookupNF(name, &xObjRef);
+  xObjDict.dictLookup(name, &xObj);
+  if (xObj.isStream()) {
+    xObj.streamGetDict()->lookup("Subtype", &subtype);
+    if (subtype.isName("Image")) {
+      ++images;
+    } else if (subtype.isName("Form") &&
+               formStack.size() < maxProbeFormDepth) {
+      loop = gFalse;
+      if (xObjRef.isRef()) {
+        ref = xObjRef.getRef();
+        for (i = 0; i < formStack.size(); ++i) {
+          if (formStack[i].num == ref.num && formStack[i].gen == ref.gen) {
+            loop = gTrue;
+          }
         }
-        n = uMap->mapUnicode(u, buf, sizeof(buf));
-        buf[n] = '\0';
-        valueStr += escape_json(buf);
+      } else {
+        ref.num = ref.gen = -1;
+      }
+      if (!loop) {
+        formStack.push_back(ref);
+        savedRenderMode = renderMode;
+        savedBytesPerGlyph = bytesPerGlyph;
+        xObj.streamGetDict()->lookup("Resources", &formRes);
+        scan(&xObj, formRes.isDict() ? formRes.getDict() : resDict);
+        formRes.free();
+        renderMode = savedRenderMode;
+        bytesPerGlyph = savedBytesPerGlyph;
+        formStack.pop_back();
       }
-      fprintf(f, "\"%s\":\"%s\"", keyStr.c_str(), valueStr.c_str());
     }
+    subtype.free();
   }
+  xObj.free();
+  xObjRef.free();
+  xObjDict.free();
 }
 
-void printDocJSON(FILE *f, PDFDoc *doc, TextOutputDev *textOut, int first, int last, UnicodeMap *uMap) {
-  double xMin, yMin, xMax, yMax;
+// Probe output: per page [glyphs, invisibleGlyphs, images, inlineImages].
+void printDocProbeJSON(FILE *f, PDFDoc *doc, std::vector<int> &pages, UnicodeMap *uMap) {
+  ContentProbe *probe;
+  Page *page;
+  Object contents;
+
+  fprintf(f, "{\"metadata\":{");
+
+  Object info;
+  doc->getDocInfo(&info);
+  if (info.isDict()) {
+    printInfoJSON(f, info.getDict(), uMap);
+  }
+  info.free();
+
+  fprintf(f, "},");
+  fprintf(f, "\"totalPages\":%d,", doc->getNumPages());
+  if (pagesStr[0]) {
+    printIntArrayJSON(f, "pageNumbers", pages);
+    fprintf(f, ",");
+  }
+  fprintf(f, "\"pages\":[");
+  for (size_t pageIdx = 0; pageIdx < pages.size(); ++pageIdx) {
+    if (pageIdx > 0) fprintf(f, ",");
+    probe = new ContentProbe(doc->getXRef());
+    if ((page = doc->getCatalog()->getPage(pages[pageIdx]))) {
+      page->getContents(&contents);
+      probe->scan(&contents, page->getResourceDict());
+      contents.free();
+    }
+    fprintf(f, "[%d,%d,%d,%d]", probe->glyphs, probe->invisibleGlyphs,
+            probe->images, probe->inlineImages);
+    delete probe;
+  }
+  fprintf(f, "]}");
+}
+
+// If <indexF> is not NULL, a "<page> <offset> <length>" line is
+// written to it for each page as soon as that page's JSON fragment has
+// been flushed to <f>, so a reader can seek straight to one page.
+// <rawTextOut> is used for pages that go over the per-page budgets; it
+// is NULL if there are no budgets or the main output is already in raw
+// order.  Stops early, still writing valid JSON with a "truncated"
+// reason, once the -timeout deadline passes or the output reaches
+// -maxoutput; returns true in that case.
+GBool printDocJSON(FILE *f, FILE *indexF, PDFDoc *doc, JSONTextOutputDev *textOut,
+                   JSONTextOutputDev *rawTextOut, std::vector<int> &pages,
+                   UnicodeMap *uMap) {
   TextPage *text;
-  GList *cols, *pars, *lines, *words;
-  TextColumn *col;
-  TextParagraph *par;
-  TextLine *line;
-  TextWord *word;
-  int colIdx, parIdx, lineIdx, wordIdx;
+  GList *cols;
+  TextWordList *wordList;
+  GList *rawLines;
+  GFileOffset pageStart, pageEnd;
+  StringTable *strTable;
+  GBool strTableReset;
+  PageFallback fallback;
+  GBool rawText;
+  const char *truncated;
 
-  std::map<std::string, int> fonts;
+  FontTable fonts;
   std::map<std::string, int> colors;
-  std::map<std::string, int>::iterator it;
 
   fprintf(f, "{\"metadata\":{");
 
@@ -188,135 +2000,302 @@ void printDocJSON(FILE *f, PDFDoc *doc, TextOutputDev *textOut, int first, int l
   if (info.isDict()) {
     printInfoJSON(f, info.getDict(), uMap);
   }
+  info.free();
 
   fprintf(f, "},");
   fprintf(f, "\"totalPages\":%d,", doc->getNumPages());
+  if (rawOrder) {
+    fprintf(f, "\"mode\":\"raw\",");
+  }
+  if (columnar) {
+    fprintf(f, "\"layout\":\"columnar\",");
+  }
+  if (quantizeGrid > 0) {
+    fprintf(f, "\"quantize\":%d,", quantizeGrid);
+  }
+  if (wordFields != wordFieldAll) {
+    fprintf(f, "\"fields\":[");
+    bool firstN = true;
+    for (int i = 0; wordFieldNames[i]; ++i) {
+      if (wordFields & (1 << i)) {
+        if (firstN) firstN = false; else fprintf(f, ",");
+        fprintf(f, "\"%s\"", wordFieldNames[i]);
+      }
+    }
+    fprintf(f, "],");
+  }
+  if (stringTable && !columnar) {
+    fprintf(f, "\"stringTable\":true,");
+    strTable = new StringTable();
+  } else {
+    strTable = NULL;
+  }
+  if (pagesStr[0]) {
+    printIntArrayJSON(f, "pageNumbers", pages);
+    fprintf(f, ",");
+  }
   fprintf(f, "\"pages\":[");
+  truncated = NULL;
   bool firstP = true;
-  for (int page = first; page <= last; ++page) {
+  for (size_t pageIdx = 0; pageIdx < pages.size(); ++pageIdx) {
+    int page = pages[pageIdx];
+    if (docDeadline > 0 && getWallTime() > docDeadline) {
+      truncated = "timeout";
+      break;
+    }
+    if (maxOutput > 0 && gftell(f) >= maxOutput * 1024 * 1024) {
+      truncated = "maxoutput";
+      break;
+    }
     if (firstP) firstP = false; else fprintf(f, ",");
-    fprintf(f, "[%g,%g,[", doc->getPageMediaWidth(page), doc->getPageMediaHeight(page));
-    doc->displayPage(textOut, page, 72, 72, 0, gTrue, gFalse, gFalse);
-    text = textOut->takeText();
+    pageStart = gftell(f);
+    fprintf(f, "[%g,%g,", doc->getPageMediaWidth(page), doc->getPageMediaHeight(page));
+    if (pageIdx + 1 < pages.size()) {
+      startPrefetch(doc, pages[pageIdx + 1]);
+    }
+    text = displayPageJSON(doc, page, textOut, rawTextOut, &fallback,
+                           &rawText);
+    advancePrefetch(doc);
+    if (fallback == pageFallbackTruncated && docDeadline > 0 &&
+        getWallTime() > docDeadline) {
+      // cut off by the document deadline, possibly on the last page
+      truncated = "timeout";
+    }
 
-    cols = text->makeColumns();
-
-    bool firstF = true;
-    for (colIdx = 0; colIdx < cols->getLength(); ++colIdx) {
-      col = (TextColumn *) cols->get(colIdx);
-      if (firstF) firstF = false; else fprintf(f, ",");
-      fprintf(f, "[[");
-      bool firstB = true;
-      pars = col->getParagraphs();
-      for (parIdx = 0; parIdx < pars->getLength(); ++parIdx) {
-        par = (TextParagraph *) pars->get(parIdx);
-        if (firstB) firstB = false; else fprintf(f, ",");
-        fprintf(f, "[%g,%g,%g,%g,[", par->getXMin(), par->getYMin(), par->getXMax(), par->getYMin());
-        bool firstL = true;
-        lines = par->getLines();
-        for (lineIdx = 0; lineIdx < lines->getLength(); ++lineIdx) {
-          line = (TextLine *) lines->get(lineIdx);
-          if (firstL) firstL = false; else fprintf(f, ",");
-          fprintf(f, "[[");
-          bool firstW = true;
-
-          words = line->getWords();
-
-          for (wordIdx = 0; wordIdx < words->getLength(); ++wordIdx) {
-            word = (TextWord *) words->get(wordIdx);
-
-            if (firstW) firstW = false; else fprintf(f, ",");
-            word->getBBox(&xMin, &yMin, &xMax, &yMax);
-            const std::string myString = escape_json(word->getText()->getCString());
-
-            // Instead of the actual RGB offsets we only output a unique color number
-            double dr, dg, db;
-            int r, g, b;
-            char colorStr[256];
-            int color_nr = 0;
-
-            word->getColor(&dr, &dg, &db);
-            r = 255.0 * dr;
-            g = 255.0 * dg;
-            b = 255.0 * db;
-
-            sprintf(colorStr, "%02x%02x%02x", r, g, b);
-
-            colors.insert(std::make_pair(colorStr, colors.size()));
-            it = colors.find(colorStr);
-            if (it != colors.end()) {
-              color_nr = it->second;
-            }
-
-            // Instead of the actual font names we only output a unique font number
-            int font_nr = 0;
-            TextFontInfo *fontInfo = word->getFontInfo();
-
-            if (fontInfo && fontInfo->getFontName()) {
-              const std::string fontName = escape_json(fontInfo->getFontName()->getCString());
-              fonts.insert(std::make_pair(fontName, fonts.size()));
-              it = fonts.find(fontName);
-              if (it != fonts.end()) {
-                font_nr = it->second;
-              }
-            }
-
-            fprintf(f,
-                    "["
-                            "%g,"
-                            "%g,"
-                            "%g,"
-                            "%g,"
-                            "%g,"
-                            "%d,"
-                            "%g,"
-                            "%d,"
-                            "%d,"
-                            "%d,"
-                            "%d,"
-                            "%d,"
-                            "%d,"
-                            "\"%s\""
-                            "]",
-                    xMin,
-                    yMin,
-                    xMax,
-                    yMax,
-                    word->getFontSize(),
-                    word->getSpaceAfter(),
-                    word->getBaseline(),
-                    word->getRotation(),
-                    word->isUnderlined(),
-                    fontInfo->isBold(),
-                    fontInfo->isItalic(),
-                    color_nr,
-                    font_nr,
-                    myString.c_str()
-            );
-          }
-          fprintf(f, "]]");
+    strTableReset = strTable && strTable->startPage();
+    if (rawOrder || rawText) {
+      // words come back in content stream order; skip column and
+      // paragraph reconstruction entirely
+      wordList = text->makeWordList();
+      rawLines = makeRawLines(wordList);
+      if (columnar) {
+        printPageRawColumnarJSON(f, wordList, rawLines, fonts, colors);
+      } else {
+        printPageRawNestedJSON(f, wordList, rawLines, strTable, fonts, colors);
+      }
+      freeRawLines(rawLines);
+      delete wordList;
+    } else {
+      // not interruptible: -timeout doesn't bound reading-order layout
+      cols = text->makeColumns();
+      if (columnar) {
+        printPageColumnarJSON(f, cols, fonts, colors);
+      } else {
+        printPageNestedJSON(f, cols, strTable, fonts, colors);
+      }
+      deleteGList(cols, TextColumn);
+    }
+    fonts.pageFonts.clear();
+    delete text;
+
+    // optional per-page info
+    if (strTable || fallback != pageFallbackNone || annotsJSON) {
+      fprintf(f, ",{");
+      bool firstI = true;
+      if (fallback != pageFallbackNone) {
+        fprintf(f, "\"fallback\":\"%s\"", pageFallbackNames[fallback]);
+        firstI = false;
+      }
+      if (annotsJSON) {
+        if (!firstI) fprintf(f, ",");
+        Page *pageObj = doc->getCatalog()->getPage(page);
+        if (pageObj) {
+          printAnnotsJSON(f, pageObj, uMap);
+        } else {
+          fprintf(f, "\"annotations\":[]");
         }
-        fprintf(f, "]]");
+        firstI = false;
       }
-      fprintf(f, "]]");
+      if (strTable) {
+        if (!firstI) fprintf(f, ",");
+        if (strTableReset) {
+          fprintf(f, "\"reset\":true,");
+        }
+        fprintf(f, "\"strings\":[");
+        std::vector<std::string> &newStrings = strTable->getNewStrings();
+        for (size_t i = 0; i < newStrings.size(); ++i) {
+          if (i) fprintf(f, ",");
+          fprintf(f, "\"%s\"", escape_json(newStrings[i]).c_str());
+        }
+        fprintf(f, "]");
+      }
+      fprintf(f, "}");
+    }
+
+    fprintf(f, "]");
+
+    if (indexF) {
+      pageEnd = gftell(f);
+      fflush(f);
+      fprintf(indexF, "%d %lld %lld\n", page,
+              (long long)pageStart, (long long)(pageEnd - pageStart));
+      fflush(indexF);
     }
-    fprintf(f, "]]");
   }
-  fprintf(f, "]}");
+  fprintf(f, "]");
+  if (truncated) {
+    fprintf(f, ",\"truncated\":\"%s\"", truncated);
+  }
+  fprintf(f, "}");
+
+  delete strTable;
+  return truncated != NULL;
+}
+
+//------------------------------------------------------------------------
+// RangeStream (-ranges)
+//------------------------------------------------------------------------
+
+#define rangeStreamBufSize 4096
+
+// BaseStream over a GRangeFile, so a PDFDoc can be parsed from a file
+// that is still being fetched.  It works like FileStream, but reads
+// are positional and wait for (or fail on) missing byte ranges.  A
+// failed read looks like end of file to the parser.
+class RangeStream: public BaseStream {
+public:
+
+  RangeStream(GRangeFile *fileA, GFileOffset startA, GBool limitedA,
+              GFileOffset lengthA, Object *dictA);
+  virtual ~RangeStream() {}
+  virtual Stream *copy();
+  virtual Stream *makeSubStream(GFileOffset startA, GBool limitedA,
+                                GFileOffset lengthA, Object *dictA);
+  virtual StreamKind getKind() { return strFile; }
+  virtual void reset();
+  virtual int getChar()
+    { return (bufPtr >= bufEnd && !fillBuf()) ? EOF : (*bufPtr++ & 0xff); }
+  virtual int lookChar()
+    { return (bufPtr >= bufEnd && !fillBuf()) ? EOF : (*bufPtr & 0xff); }
+  virtual int getBlock(char *blk, int size);
+  virtual GFileOffset getPos() { return bufPos + (int)(bufPtr - buf); }
+  virtual void setPos(GFileOffset pos, int dir = 0);
+  virtual GFileOffset getStart() { return start; }
+  virtual void moveStart(int delta);
+
+private:
+
+  GBool fillBuf();
+
+  GRangeFile *file;
+  GFileOffset start;
+  GBool limited;
+  GFileOffset length;
+  char buf[rangeStreamBufSize];
+  char *bufPtr;
+  char *bufEnd;
+  GFileOffset bufPos;
+};
+
+RangeStream::RangeStream(GRangeFile *fileA, GFileOffset startA,
+                         GBool limitedA, GFileOffset lengthA,
+                         Object *dictA):
+    BaseStream(dictA) {
+  file = fileA;
+  start = startA;
+  limited = limitedA;
+  length = lengthA;
+  bufPtr = bufEnd = buf;
+  bufPos = start;
+}
+
+Stream *RangeStream::copy() {
+  Object dictA;
+
+  dict.copy(&dictA);
+  return new RangeStream(file, start, limited, length, &dictA);
+}
+
+Stream *RangeStream::makeSubStream(GFileOffset startA, GBool limitedA,
+                                   GFileOffset lengthA, Object *dictA) {
+  return new RangeStream(file, startA, limitedA, lengthA, dictA);
+}
+
+void RangeStream::reset() {
+  bufPtr = bufEnd = buf;
+  bufPos = start;
+}
+
+GBool RangeStream::fillBuf() {
+  int n;
+
+  bufPos += (int)(bufEnd - buf);
+  bufPtr = bufEnd = buf;
+  if (limited && bufPos >= start + length) {
+    return gFalse;
+  }
+  if (limited && bufPos + rangeStreamBufSize > start + length) {
+    n = (int)(start + length - bufPos);
+  } else {
+    n = rangeStreamBufSize;
+  }
+  if ((n = file->read(buf, n, bufPos)) <= 0) {
+    return gFalse;
+  }
+  bufEnd = buf + n;
+  return gTrue;
+}
+
+int RangeStream::getBlock(char *blk, int size) {
+  int n, m;
+
+  n = 0;
+  while (n < size) {
+    if (bufPtr >= bufEnd && !fillBuf()) {
+      break;
+    }
+    m = (int)(bufEnd - bufPtr);
+    if (m > size - n) {
+      m = size - n;
+    }
+    memcpy(blk + n, bufPtr, m);
+    bufPtr += m;
+    n += m;
+  }
+  return n;
+}
+
+void RangeStream::setPos(GFileOffset pos, int dir) {
+  GFileOffset size;
+
+  if (dir >= 0) {
+    bufPos = pos;
+  } else {
+    size = file->getSize();
+    if (pos > size) {
+      pos = size;
+    }
+    bufPos = size - pos;
+  }
+  bufPtr = bufEnd = buf;
+}
+
+void RangeStream::moveStart(int delta) {
+  start += delta;
+  bufPtr = bufEnd = buf;
+  bufPos = start;
 }
 
 int main(int argc, char *argv[]) {
   PDFDoc *doc;
   GString *fileName;
+  GRangeFile *rangeFile;
   GString *textFileName;
   TextOutputControl textOutControl;
+  TextOutputControl rawTextOutControl;
   TextOutputDev *textOut;
+  JSONTextOutputDev *jsonTextOut, *rawTextOut;
   UnicodeMap *uMap;
   GBool ok;
   int exitCode;
   FILE *f;
+  FILE *indexF;
+  GBool truncated;
+  std::vector<int> pages;
 
   exitCode = 99;
+  truncated = gFalse;
+  rangeFile = NULL;
 
   // parse args
   ok = parseArgs(argDesc, &argc, argv);
@@ -330,6 +2309,10 @@ int main(int argc, char *argv[]) {
     goto err0;
   }
 
+  if (docTimeout > 0) {
+    docDeadline = getWallTime() + docTimeout;
+  }
+
   fileName = new GString(argv[1]);
 
   // read config file
@@ -345,6 +2328,25 @@ int main(int argc, char *argv[]) {
   if (quiet) {
     globalParams->setErrQuiet(quiet);
   }
+  if (noAnnots) {
+    globalParams->setDrawAnnotations(gFalse);
+    globalParams->setDrawFormFields(gFalse);
+  }
+
+  if (fieldsStr[0] && !parseWordFields(fieldsStr, &wordFields)) {
+    GString *validFields = new GString();
+    for (int i = 0; wordFieldNames[i]; ++i) {
+      if (i > 0) {
+        validFields->append(',');
+      }
+      validFields->append(wordFieldNames[i]);
+    }
+    error(errCommandLine, -1, "Invalid -fields list '{0:s}' (valid fields: {1:t})",
+          fieldsStr, validFields);
+    delete validFields;
+    delete fileName;
+    goto err1;
+  }
 
   // get mapping to output encoding
   if (!(uMap = globalParams->getTextEncoding())) {
@@ -356,7 +2358,33 @@ int main(int argc, char *argv[]) {
   globalParams->scanEncodingDirs(datadir);
 
 
-  doc = new PDFDoc(fileName);
+  if (rangesFileName[0] || rangeDelay >= 0 || neededRangesFileName[0]) {
+    if (rangesFileName[0]) {
+      GString *rangesName = new GString(rangesFileName);
+      rangeFile = GRangeFile::open(fileName, rangesName);
+      delete rangesName;
+    } else {
+      rangeFile = GRangeFile::openWithDelay(fileName,
+                                            rangeDelay < 0 ? 0 : rangeDelay);
+    }
+    if (!rangeFile) {
+      error(errIO, -1, "Couldn't open file '{0:t}'", fileName);
+      delete fileName;
+      doc = NULL;
+      exitCode = 1;
+      goto err2;
+    }
+    rangeFile->setWaitTime(rangeWait < 0 ? -1 : (int)(rangeWait * 1000));
+    Object obj;
+    obj.initNull();
+    doc = new PDFDoc(new RangeStream(rangeFile, 0, gFalse, 0, &obj));
+    delete fileName;
+  } else {
+    if (prefetch) {
+      prefetchFile = openFile(fileName->getCString(), "rb");
+    }
+    doc = new PDFDoc(fileName);
+  }
 
   if (!doc->isOk()) {
     exitCode = 1;
@@ -367,11 +2395,21 @@ int main(int argc, char *argv[]) {
   textFileName = new GString(argv[2]);
 
   // get page range
-  if (firstPage < 1) {
-    firstPage = 1;
-  }
-  if (lastPage < 1 || lastPage > doc->getNumPages()) {
-    lastPage = doc->getNumPages();
+  if (pagesStr[0]) {
+    if (!parsePageList(pagesStr, doc->getNumPages(), pages)) {
+      error(errCommandLine, -1, "Invalid page list '{0:s}'", pagesStr);
+      goto err3;
+    }
+  } else {
+    if (firstPage < 1) {
+      firstPage = 1;
+    }
+    if (lastPage < 1 || lastPage > doc->getNumPages()) {
+      lastPage = doc->getNumPages();
+    }
+    for (int pg = firstPage; pg <= lastPage; ++pg) {
+      pages.push_back(pg);
+    }
   }
 
   // write text file
@@ -396,23 +2434,61 @@ int main(int argc, char *argv[]) {
   textOutControl.discardDiagonalText = discardDiag;
   textOutControl.insertBOM = insertBOM;
 
-  // output JSON
-  if (json) {
+  // probe for a text layer
+  if (probe) {
+    if (!(f = fopen(textFileName->getCString(), "wb"))) {
+      error(errIO, -1, "Couldn't open text file '{0:t}'", textFileName);
+      exitCode = 2;
+      goto err3;
+    }
+    textOut = NULL;
+    printDocProbeJSON(f, doc, pages, uMap);
+    fclose(f);
+  } // output JSON
+  else if (json) {
     if (!(f = fopen(textFileName->getCString(), "wb"))) {
       error(errIO, -1, "Couldn't open text file '{0:t}'", textFileName);
       exitCode = 2;
       goto err3;
     }
-    textOut = new TextOutputDev(NULL, &textOutControl, gFalse);
+    indexF = NULL;
+    if (pageIndexFileName[0] &&
+        !(indexF = openFile(pageIndexFileName, "wb"))) {
+      error(errIO, -1, "Couldn't open page index file '{0:s}'",
+            pageIndexFileName);
+      fclose(f);
+      exitCode = 2;
+      goto err3;
+    }
+    textOut = jsonTextOut = new JSONTextOutputDev(&textOutControl);
+    jsonTextOut->setTextOnly(textOnly);
+    rawTextOut = NULL;
+    if ((maxChars > 0 || pageTimeout > 0) && !rawOrder) {
+      rawTextOutControl = textOutControl;
+      rawTextOutControl.mode = textOutRawOrder;
+      rawTextOut = new JSONTextOutputDev(&rawTextOutControl);
+      rawTextOut->setTextOnly(textOnly);
+    }
     if (textOut->isOk()) {
-      printDocJSON(f, doc, textOut, firstPage, lastPage, uMap);
+      truncated = printDocJSON(f, indexF, doc, jsonTextOut, rawTextOut,
+                               pages, uMap);
+    }
+    delete rawTextOut;
+    if (indexF) {
+      fclose(indexF);
     }
     fclose(f);
   } // output text
   else {
     textOut = new TextOutputDev(textFileName->getCString(), &textOutControl, gFalse);
     if (textOut->isOk()) {
-      doc->displayPages(textOut, firstPage, lastPage, 72, 72, 0, gTrue, gFalse, gFalse);
+      for (size_t pageIdx = 0; pageIdx < pages.size(); ++pageIdx) {
+        if (pageIdx + 1 < pages.size()) {
+          startPrefetch(doc, pages[pageIdx + 1]);
+        }
+        doc->displayPage(textOut, pages[pageIdx], 72, 72, 0, gTrue, gFalse, gFalse);
+        advancePrefetch(doc);
+      }
     } else {
       delete textOut;
       exitCode = 2;
@@ -422,13 +2498,37 @@ int main(int argc, char *argv[]) {
 
   delete textOut;
 
-  exitCode = 0;
+  // distinguish a deliberately shortened result from real errors
+  exitCode = truncated ? 4 : 0;
 
   // clean up
   err3:
   delete textFileName;
   err2:
   delete doc;
+  if (prefetchFile) {
+    fclose(prefetchFile);
+  }
+  if (rangeFile) {
+    if (rangeFile->getNumMissing() > 0) {
+      error(errIO, -1, "Input data was missing for {0:d} read(s)",
+            rangeFile->getNumMissing());
+      if (exitCode != 2) {
+        exitCode = 5;
+      }
+    }
+    if (neededRangesFileName[0]) {
+      if ((f = openFile(neededRangesFileName, "wb"))) {
+        rangeFile->writeNeededRanges(f);
+        fclose(f);
+      } else {
+        error(errIO, -1, "Couldn't open needed ranges file '{0:s}'",
+              neededRangesFileName);
+        exitCode = 2;
+      }
+    }
+    delete rangeFile;
+  }
   uMap->decRefCnt();
   err1:
   delete globalParams;